@@ -29,6 +29,7 @@
 
 #include "libupnpp/control/avlastchg.hxx"
 #include "libupnpp/control/cdircontent.hxx"
+#include "libupnpp/cstrhash.hxx"
 #include "libupnpp/log.hxx"
 #include "libupnpp/soaphelp.hxx"
 #include "libupnpp/upnpavutils.hxx"
@@ -59,61 +60,69 @@ bool AVTransport::serviceTypeMatch(const std::string& tp)
     return isAVTService(tp);
 }
 
+// The enumerated values are dispatched on a compile-time hash of the upper-cased input (see
+// cstrhash.hxx), and the match confirmed by a string comparison.
 static AVTransport::TransportState stringToTpState(const string& s)
 {
-    if (!stringuppercmp("STOPPED", s)) {
-        return AVTransport::Stopped;
-    } else if (!stringuppercmp("PLAYING", s)) {
-        return AVTransport::Playing;
-    } else if (!stringuppercmp("TRANSITIONING", s)) {
-        return AVTransport::Transitioning;
-    } else if (!stringuppercmp("PAUSED_PLAYBACK", s)) {
-        return AVTransport::PausedPlayback;
-    } else if (!stringuppercmp("PAUSED_RECORDING", s)) {
-        return AVTransport::PausedRecording;
-    } else if (!stringuppercmp("RECORDING", s)) {
-        return AVTransport::Recording;
-    } else if (!stringuppercmp("NO_MEDIA_PRESENT", s)) {
-        return AVTransport::NoMediaPresent;
-    } else {
+    AVTransport::TransportState st{AVTransport::Unknown};
+    const char *ref{""};
+    switch (strhashupper(s)) {
+    case strhash("STOPPED"): st = AVTransport::Stopped; ref = "STOPPED"; break;
+    case strhash("PLAYING"): st = AVTransport::Playing; ref = "PLAYING"; break;
+    case strhash("TRANSITIONING"): st = AVTransport::Transitioning; ref = "TRANSITIONING"; break;
+    case strhash("PAUSED_PLAYBACK"):
+        st = AVTransport::PausedPlayback; ref = "PAUSED_PLAYBACK"; break;
+    case strhash("PAUSED_RECORDING"):
+        st = AVTransport::PausedRecording; ref = "PAUSED_RECORDING"; break;
+    case strhash("RECORDING"): st = AVTransport::Recording; ref = "RECORDING"; break;
+    case strhash("NO_MEDIA_PRESENT"):
+        st = AVTransport::NoMediaPresent; ref = "NO_MEDIA_PRESENT"; break;
+    default: break;
+    }
+    if (st == AVTransport::Unknown || stringuppercmp(ref, s)) {
         LOGINF("AVTransport event: bad value for TransportState: "
                << s << "\n");
         return AVTransport::Unknown;
     }
+    return st;
 }
 
 static AVTransport::TransportStatus stringToTpStatus(const string& s)
 {
-    if (!stringuppercmp("OK", s)) {
-        return AVTransport::TPS_Ok;
-    } else if (!stringuppercmp("ERROR_OCCURRED", s)) {
-        return  AVTransport::TPS_Error;
-    } else {
+    AVTransport::TransportStatus st{AVTransport::TPS_Unknown};
+    const char *ref{""};
+    switch (strhashupper(s)) {
+    case strhash("OK"): st = AVTransport::TPS_Ok; ref = "OK"; break;
+    case strhash("ERROR_OCCURRED"): st = AVTransport::TPS_Error; ref = "ERROR_OCCURRED"; break;
+    default: break;
+    }
+    if (st == AVTransport::TPS_Unknown || stringuppercmp(ref, s)) {
         LOGERR("AVTransport event: bad value for TransportStatus: "
                << s << "\n");
         return  AVTransport::TPS_Unknown;
     }
+    return st;
 }
 
 static AVTransport::PlayMode stringToPlayMode(const string& s)
 {
-    if (!stringuppercmp("NORMAL", s)) {
-        return AVTransport::PM_Normal;
-    } else if (!stringuppercmp("SHUFFLE", s)) {
-        return AVTransport::PM_Shuffle;
-    } else if (!stringuppercmp("REPEAT_ONE", s)) {
-        return AVTransport::PM_RepeatOne;
-    } else if (!stringuppercmp("REPEAT_ALL", s)) {
-        return AVTransport::PM_RepeatAll;
-    } else if (!stringuppercmp("RANDOM", s)) {
-        return AVTransport::PM_Random;
-    } else if (!stringuppercmp("DIRECT_1", s)) {
-        return AVTransport::PM_Direct1;
-    } else {
+    AVTransport::PlayMode pm{AVTransport::PM_Unknown};
+    const char *ref{""};
+    switch (strhashupper(s)) {
+    case strhash("NORMAL"): pm = AVTransport::PM_Normal; ref = "NORMAL"; break;
+    case strhash("SHUFFLE"): pm = AVTransport::PM_Shuffle; ref = "SHUFFLE"; break;
+    case strhash("REPEAT_ONE"): pm = AVTransport::PM_RepeatOne; ref = "REPEAT_ONE"; break;
+    case strhash("REPEAT_ALL"): pm = AVTransport::PM_RepeatAll; ref = "REPEAT_ALL"; break;
+    case strhash("RANDOM"): pm = AVTransport::PM_Random; ref = "RANDOM"; break;
+    case strhash("DIRECT_1"): pm = AVTransport::PM_Direct1; ref = "DIRECT_1"; break;
+    default: break;
+    }
+    if (pm == AVTransport::PM_Unknown || stringuppercmp(ref, s)) {
         LOGERR("AVTransport event: bad value for PlayMode: "
                << s << "\n");
         return AVTransport::PM_Unknown;
     }
+    return pm;
 }
 
 void AVTransport::evtCallback(const std::unordered_map<std::string, std::string>& props)
@@ -160,7 +169,7 @@ void AVTransport::evtCallback(const std::unordered_map<std::string, std::string>
                        varnm == "RelativeCounterPosition" ||
                        varnm == "AbsoluteCounterPosition" ||
                        varnm == "InstanceID") {
-                reporter->changed(varnm.c_str(), atoi(varvalue.c_str()));
+                reporter->changed(varnm.c_str(), stringToInt(varvalue));
             } else if (varnm == "CurrentMediaDuration" ||
                        varnm == "CurrentTrackDuration" ||
                        varnm == "RelativeTimePosition" ||
@@ -255,7 +264,8 @@ int AVTransport::getMediaInfo(MediaInfo& info, int instanceID)
     string s;
     data.get("NrTracks", &info.nrtracks);
     data.get("MediaDuration", &s);
-    info.mduration = upnpdurationtos(s);
+    info.mdurationms = upnpdurationtoms(s);
+    info.mduration = info.mdurationms / 1000;
     data.get("CurrentURI", &info.cururi);
     data.get("CurrentURIMetaData", &s);
     UPnPDirContent meta;
@@ -274,42 +284,49 @@ int AVTransport::getMediaInfo(MediaInfo& info, int instanceID)
     return 0;
 }
 
-int AVTransport::getTransportInfo(TransportInfo& info, int instanceID)
+static void decodeTransportInfo(SoapIncoming& data, AVTransport::TransportInfo& info)
 {
-    SoapOutgoing args(getServiceType(), "GetTransportInfo");
-    args("InstanceID", SoapHelp::i2s(instanceID));
-    SoapIncoming data;
-    int ret = runAction(args, data);
-    if (ret != UPNP_E_SUCCESS) {
-        return ret;
-    }
     string s;
     data.get("CurrentTransportState", &s);
     info.tpstate = stringToTpState(s);
     data.get("CurrentTransportStatus", &s);
     info.tpstatus = stringToTpStatus(s);
     data.get("CurrentSpeed", &info.curspeed);
-    return 0;
 }
 
-int AVTransport::getPositionInfo(PositionInfo& info, int instanceID, int timeoutms)
+int AVTransport::getTransportInfo(TransportInfo& info, int instanceID)
 {
-    SoapOutgoing args(getServiceType(), "GetPositionInfo");
+    SoapOutgoing args(getServiceType(), "GetTransportInfo");
     args("InstanceID", SoapHelp::i2s(instanceID));
     SoapIncoming data;
-    ActionOptions opts;
-    if (timeoutms >= 0) {
-        opts.active_options |= AOM_TIMEOUTMS;
-        opts.timeoutms = timeoutms;
-    }
-    int ret = runAction(args, data, &opts);
+    int ret = runAction(args, data);
     if (ret != UPNP_E_SUCCESS) {
         return ret;
     }
+    decodeTransportInfo(data, info);
+    return 0;
+}
+
+bool AVTransport::getTransportInfoAsync(TransportInfoCB cb, int instanceID)
+{
+    SoapOutgoing args(getServiceType(), "GetTransportInfo");
+    args("InstanceID", SoapHelp::i2s(instanceID));
+    return runActionAsync(args, [cb] (int status, SoapIncoming& data) {
+        TransportInfo info{};
+        if (status == UPNP_E_SUCCESS) {
+            decodeTransportInfo(data, info);
+        }
+        cb(status, info);
+    });
+}
+
+static void decodePositionInfo(SoapIncoming& data, AVTransport::PositionInfo& info)
+{
     string s;
     data.get("Track", &info.track);
     data.get("TrackDuration", &s);
-    info.trackduration = upnpdurationtos(s);
+    info.trackdurationms = upnpdurationtoms(s);
+    info.trackduration = info.trackdurationms / 1000;
     data.get("TrackMetaData", &s);
     if (!s.empty()) {
         UPnPDirContent meta;
@@ -322,14 +339,51 @@ int AVTransport::getPositionInfo(PositionInfo& info, int instanceID, int timeout
     }
     data.get("TrackURI", &info.trackuri);
     data.get("RelTime", &s);
-    info.reltime = upnpdurationtos(s);
+    info.reltimems = upnpdurationtoms(s);
+    info.reltime = info.reltimems / 1000;
     data.get("AbsTime", &s);
-    info.abstime = upnpdurationtos(s);
+    info.abstimems = upnpdurationtoms(s);
+    info.abstime = info.abstimems / 1000;
     data.get("RelCount", &info.relcount);
     data.get("AbsCount", &info.abscount);
+}
+
+int AVTransport::getPositionInfo(PositionInfo& info, int instanceID, int timeoutms)
+{
+    SoapOutgoing args(getServiceType(), "GetPositionInfo");
+    args("InstanceID", SoapHelp::i2s(instanceID));
+    SoapIncoming data;
+    ActionOptions opts;
+    if (timeoutms >= 0) {
+        opts.active_options |= AOM_TIMEOUTMS;
+        opts.timeoutms = timeoutms;
+    }
+    int ret = runAction(args, data, &opts);
+    if (ret != UPNP_E_SUCCESS) {
+        return ret;
+    }
+    decodePositionInfo(data, info);
     return 0;
 }
 
+bool AVTransport::getPositionInfoAsync(PositionInfoCB cb, int instanceID, int timeoutms)
+{
+    SoapOutgoing args(getServiceType(), "GetPositionInfo");
+    args("InstanceID", SoapHelp::i2s(instanceID));
+    ActionOptions opts;
+    if (timeoutms >= 0) {
+        opts.active_options |= AOM_TIMEOUTMS;
+        opts.timeoutms = timeoutms;
+    }
+    return runActionAsync(args, [cb] (int status, SoapIncoming& data) {
+        PositionInfo info{};
+        if (status == UPNP_E_SUCCESS) {
+            decodePositionInfo(data, info);
+        }
+        cb(status, info);
+    }, &opts);
+}
+
 int AVTransport::getDeviceCapabilities(DeviceCapabilities& info, int iID)
 {
     SoapOutgoing args(getServiceType(), "GetDeviceCapabilities");
@@ -391,18 +445,19 @@ int AVTransport::CTAStringToBits(const string& actions, int& iacts)
         // It's not clear if the values are case sensitive, they are
         // as below in the doc. gmediarender for one, uses
         // all-caps. So let's compare insensitively.
-        if (!stringicmp(act, "Next")) {
-            iacts |= TPA_Next;
-        } else if (!stringicmp(act, "Pause")) {
-            iacts |= TPA_Pause;
-        } else if (!stringicmp(act, "Play")) {
-            iacts |= TPA_Play;
-        } else if (!stringicmp(act, "Previous")) {
-            iacts |= TPA_Previous;
-        } else if (!stringicmp(act, "Seek")) {
-            iacts |= TPA_Seek;
-        } else if (!stringicmp(act, "Stop")) {
-            iacts |= TPA_Stop;
+        int bit{0};
+        const char *ref{""};
+        switch (strhashupper(act)) {
+        case strhash("NEXT"): bit = TPA_Next; ref = "NEXT"; break;
+        case strhash("PAUSE"): bit = TPA_Pause; ref = "PAUSE"; break;
+        case strhash("PLAY"): bit = TPA_Play; ref = "PLAY"; break;
+        case strhash("PREVIOUS"): bit = TPA_Previous; ref = "PREVIOUS"; break;
+        case strhash("SEEK"): bit = TPA_Seek; ref = "SEEK"; break;
+        case strhash("STOP"): bit = TPA_Stop; ref = "STOP"; break;
+        default: break;
+        }
+        if (bit && !stringuppercmp(ref, act)) {
+            iacts |= bit;
         } else if (act.empty()) {
             continue;
         } else {
@@ -18,6 +18,7 @@
 #ifndef _AVTRANSPORT_HXX_INCLUDED_
 #define _AVTRANSPORT_HXX_INCLUDED_
 
+#include <functional>
 #include <string>
 
 #include "libupnpp/control/cdircontent.hxx"
@@ -67,6 +68,7 @@ public:
         std::string pbstoragemed;
         std::string rcstoragemed;
         std::string ws;
+        int mdurationms; // same as mduration, with the fractional seconds, if any
     };
     int getMediaInfo(MediaInfo& info, int instanceID=0);
 
@@ -81,6 +83,12 @@ public:
         int curspeed;
     };
     int getTransportInfo(TransportInfo& info, int instanceID=0);
+    /** Callback for the asynchronous version. @param info is only set if @param status is
+     * UPNP_E_SUCCESS. */
+    typedef std::function<void (int status, const TransportInfo& info)> TransportInfoCB;
+    /** Asynchronous getTransportInfo(), see Service::runActionAsync().
+     * @return false if the action could not be queued. */
+    bool getTransportInfoAsync(TransportInfoCB cb, int instanceID=0);
 
     struct PositionInfo {
         int track;
@@ -91,8 +99,19 @@ public:
         int abstime;
         int relcount;
         int abscount;
+        // Same as trackduration, reltime and abstime, in milliseconds: the fractional
+        // seconds are kept if the renderer sends them.
+        int trackdurationms;
+        int reltimems;
+        int abstimems;
     };
     int getPositionInfo(PositionInfo& info, int instanceID=0, int timeoutms=-1);
+    /** Callback for the asynchronous version. @param info is only set if @param status is
+     * UPNP_E_SUCCESS. */
+    typedef std::function<void (int status, const PositionInfo& info)> PositionInfoCB;
+    /** Asynchronous getPositionInfo(), see Service::runActionAsync().
+     * @return false if the action could not be queued. */
+    bool getPositionInfoAsync(PositionInfoCB cb, int instanceID=0, int timeoutms=-1);
 
     struct DeviceCapabilities {
         std::string playmedia;
@@ -17,16 +17,33 @@
  */
 #include "config.h"
 
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
 
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <iterator>
 #include <unordered_map>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <fstream>
 #include <iostream>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "libupnpp/control/cdircontent.hxx"
+#include "libupnpp/cstrhash.hxx"
 #include "libupnpp/expatmm.h"
 #include "libupnpp/log.hxx"
+#include "libupnpp/smallut.h"
 #include "libupnpp/upnpp_p.hxx"
 #include "libupnpp/soaphelp.hxx"
 
@@ -37,42 +54,118 @@ namespace UPnPClient {
 
 string UPnPDirObject::nullstr;
 
+// The DIDL tags we look at. The names are dispatched on a compile-time hash (see cstrhash.hxx)
+// instead of a string comparison chain, because this runs for every element.
+enum DidlTag {DIDLT_OTHER, DIDLT_CONTAINER, DIDLT_ITEM, DIDLT_TITLE, DIDLT_RES, DIDLT_ALBUMART};
+
+static DidlTag didlTag(const char *name)
+{
+    DidlTag tag{DIDLT_OTHER};
+    const char *ref{""};
+    switch (strhash(name)) {
+    case strhash("container"): tag = DIDLT_CONTAINER; ref = "container"; break;
+    case strhash("item"): tag = DIDLT_ITEM; ref = "item"; break;
+    case strhash("dc:title"): tag = DIDLT_TITLE; ref = "dc:title"; break;
+    case strhash("res"): tag = DIDLT_RES; ref = "res"; break;
+    case strhash("upnp:albumArtURI"): tag = DIDLT_ALBUMART; ref = "upnp:albumArtURI"; break;
+    default: break;
+    }
+    return strcmp(name, ref) ? DIDLT_OTHER : tag;
+}
+
+// Translate the upnp:class value for an item. Returns false if the class is not one we know.
+static bool didlItemClass(const string& cls, UPnPDirObject::ItemClass& iclass)
+{
+    const char *ref{""};
+    switch (strhash(cls)) {
+    case strhash("object.item.audioItem"):
+        iclass = UPnPDirObject::ITC_audioItem; ref = "object.item.audioItem"; break;
+    case strhash("object.item.audioItem.musicTrack"):
+        iclass = UPnPDirObject::ITC_audioItem; ref = "object.item.audioItem.musicTrack"; break;
+    case strhash("object.item.audioItem.audioBroadcast"):
+        iclass = UPnPDirObject::ITC_audioItem; ref = "object.item.audioItem.audioBroadcast"; break;
+    case strhash("object.item.audioItem.audioBook"):
+        iclass = UPnPDirObject::ITC_audioItem; ref = "object.item.audioItem.audioBook"; break;
+    case strhash("object.item.playlistItem"):
+        iclass = UPnPDirObject::ITC_playlist; ref = "object.item.playlistItem"; break;
+    case strhash("object.item.videoItem"):
+        iclass = UPnPDirObject::ITC_videoItem; ref = "object.item.videoItem"; break;
+    default:
+        return false;
+    }
+    return cls == ref;
+}
+
 // An XML parser which builds directory contents from DIDL-lite input.
 class UPnPDirParser : public inputRefXMLParser {
 public:
-    UPnPDirParser(UPnPDirContent& dir, const string& input, bool detailed)
-        : inputRefXMLParser(input), m_dir(dir), m_detailed(detailed) {
+    UPnPDirParser(const UPnPDirContent::Visitor& visitor, std::shared_ptr<const string> input,
+                  bool detailed, const UPnPDirProjection *proj)
+        : inputRefXMLParser(*input), m_visitor(visitor), m_buf(std::move(input)),
+          m_detailed(detailed) {
         //LOGDEB("UPnPDirParser: input: " << input << endl);
-        m_okitems["object.item.audioItem"] = UPnPDirObject::ITC_audioItem;
-        m_okitems["object.item.audioItem.musicTrack"] = UPnPDirObject::ITC_audioItem;
-        m_okitems["object.item.audioItem.audioBroadcast"] = UPnPDirObject::ITC_audioItem;
-        m_okitems["object.item.audioItem.audioBook"] = UPnPDirObject::ITC_audioItem;
-        m_okitems["object.item.playlistItem"] = UPnPDirObject::ITC_playlist;
-        m_okitems["object.item.videoItem"] = UPnPDirObject::ITC_videoItem;
-    }
-    UPnPDirContent& m_dir;
+        if (proj && !proj->all()) {
+            m_proj = proj;
+        }
+    }
+
+    // True if the visitor asked us to stop. Parse() then returns false, but this is not an error.
+    bool stoppedEarly() const {
+        return m_stopped;
+    }
 protected:
+    // Called before StartElement(). With a projection, this is where we decide to skip an object
+    // property element, in which case we don't store its attributes or data.
+    bool KeepAttributes(const XML_Char *name) override {
+        if (nullptr == m_proj) {
+            return true;
+        }
+        if (m_skipdepth) {
+            return false;
+        }
+        if (m_path.size() < 2) {
+            return true;
+        }
+        const string& parentname = m_path[m_path.size()-2].name;
+        if (parentname != "item" && parentname != "container") {
+            return true;
+        }
+        bool keep;
+        switch (didlTag(name)) {
+        case DIDLT_TITLE:
+            keep = true;
+            break;
+        case DIDLT_RES:
+            keep = m_proj->wantRes() && (m_proj->maxResources() == 0 ||
+                                         m_tobj.m_resources.size() < m_proj->maxResources());
+            break;
+        default:
+            keep = m_proj->wantProp(name);
+            break;
+        }
+        if (!keep) {
+            m_skipdepth = m_path.size();
+        }
+        return keep;
+    }
+
     void StartElement(const XML_Char* name, const XML_Char**) override
         {
             //LOGDEB("startElement: name [" << name << "]" << " bpos " <<
             //             XML_GetCurrentByteIndex(expat_parser) << endl);
             auto& mapattrs = m_path.back().attributes;
-            switch (name[0]) {
-            case 'c':
-                if (!strcmp(name, "container")) {
-                    m_tobj.clear(m_detailed);
-                    m_tobj.m_type = UPnPDirObject::container;
-                    m_tobj.m_id = mapattrs["id"];
-                    m_tobj.m_pid = mapattrs["parentID"];
-                }
+            switch (didlTag(name)) {
+            case DIDLT_CONTAINER:
+                m_tobj.clear(m_detailed);
+                m_tobj.m_type = UPnPDirObject::container;
+                m_tobj.m_id = mapattrs["id"];
+                m_tobj.m_pid = mapattrs["parentID"];
                 break;
-            case 'i':
-                if (!strcmp(name, "item")) {
-                    m_tobj.clear(m_detailed);
-                    m_tobj.m_type = UPnPDirObject::item;
-                    m_tobj.m_id = mapattrs["id"];
-                    m_tobj.m_pid = mapattrs["parentID"];
-                }
+            case DIDLT_ITEM:
+                m_tobj.clear(m_detailed);
+                m_tobj.m_type = UPnPDirObject::item;
+                m_tobj.m_id = mapattrs["id"];
+                m_tobj.m_pid = mapattrs["parentID"];
                 break;
             default:
                 break;
@@ -87,8 +180,7 @@ protected:
                            !m_tobj.m_title.empty();*/
 
         if (ok && m_tobj.m_type == UPnPDirObject::item) {
-            const auto& it = m_okitems.find(m_tobj.m_props["upnp:class"]);
-            if (it == m_okitems.end()) {
+            if (!didlItemClass(m_tobj.m_props["upnp:class"], m_tobj.m_iclass)) {
                 // Only log this if the record comes from an MS as e.g. naims
                 // send records with empty classes (and empty id/pid)
                 if (!m_tobj.m_id.empty()) {
@@ -96,8 +188,6 @@ protected:
                            m_tobj.m_props["upnp:class"] << "]" << '\n');
                 }
                 m_tobj.m_iclass = UPnPDirObject::ITC_unknown;
-            } else {
-                m_tobj.m_iclass = it->second;
             }
         }
 
@@ -111,60 +201,61 @@ protected:
 
     void EndElement(const XML_Char* name) override
         {
-            string parentname;
-            if (m_path.size() == 1) {
-                parentname = "root";
-            } else {
-                parentname = m_path[m_path.size()-2].name;
+            if (m_skipdepth) {
+                if (m_skipdepth == m_path.size()) {
+                    m_skipdepth = 0;
+                }
+                return;
             }
+            const string& parentname = m_path.size() == 1 ? rootname : m_path[m_path.size()-2].name;
             //LOGDEB("Closing element " << name << " inside element " <<
             //       parentname << " data " << m_path.back().data << endl);
-            if (!strcmp(name, "container")) {
+            DidlTag tag = didlTag(name);
+            if (tag == DIDLT_CONTAINER) {
                 if (checkobjok()) {
-                    m_dir.m_containers.push_back(m_tobj);
+                    visit();
                 }
-            } else if (!strcmp(name, "item")) {
+            } else if (tag == DIDLT_ITEM) {
                 if (checkobjok()) {
                     size_t len = XML_GetCurrentByteIndex(expat_parser) - m_path.back().start_index;
                     if (len > 0) {
-                        m_tobj.m_didlfrag = m_input.substr(m_path.back().start_index, len) +
-                            "</item>";
+                        m_tobj.m_didlbuf = m_buf;
+                        m_tobj.m_didloff = m_path.back().start_index;
+                        m_tobj.m_didllen = len;
                     }
-                    m_dir.m_items.push_back(m_tobj);
+                    visit();
                 }
             } else if (parentname == "item" || parentname == "container") {
-                switch (name[0]) {
-                case 'd':
-                    if (!strcmp(name, "dc:title")) {
-                        m_tobj.m_title = m_path.back().data;
+                switch (tag) {
+                case DIDLT_TITLE:
+                    m_tobj.m_title = m_path.back().data;
+                    break;
+                case DIDLT_RES:
+                {
+                    // <res protocolInfo="http-get:*:audio/mpeg:*" size="517149"
+                    // bitrate="24576" duration="00:03:35"
+                    // sampleFrequency="44100" nrAudioChannels="2">
+                    UPnPResource res;
+                    if (LibUPnP::getLibUPnP()->m->reSanitizeURLs()) {
+                        res.m_uri = reSanitizeURL(m_path.back().data);
                     } else {
-                        addprop(name, m_path.back().data);
+                        res.m_uri = m_path.back().data;
                     }
-                    break;
-                case 'r':
-                    if (!strcmp(name, "res")) {
-                        // <res protocolInfo="http-get:*:audio/mpeg:*" size="517149"
-                        // bitrate="24576" duration="00:03:35"
-                        // sampleFrequency="44100" nrAudioChannels="2">
-                        UPnPResource res;
-                        if (LibUPnP::getLibUPnP()->m->reSanitizeURLs()) {
-                            res.m_uri = reSanitizeURL(m_path.back().data);
-                        } else {
-                            res.m_uri = m_path.back().data;
+                    if (m_proj) {
+                        for (const auto& [nm, value] : m_path.back().attributes) {
+                            if (m_proj->wantResAttr(nm.c_str())) {
+                                res.m_props[nm] = value;
+                            }
                         }
-                        res.m_props = m_path.back().attributes;
-                        m_tobj.m_resources.push_back(res);
                     } else {
-                        addprop(name, m_path.back().data);
+                        res.m_props = m_path.back().attributes;
                     }
-                    break;
-                case 'u':
-                    if (!strcmp(name, "upnp:albumArtURI")) {
-                        if (LibUPnP::getLibUPnP()->m->reSanitizeURLs()) {
-                            addprop(name, reSanitizeURL(m_path.back().data));
-                        } else {
-                            addprop(name, m_path.back().data);
-                        }
+                    m_tobj.m_resources.push_back(std::move(res));
+                }
+                break;
+                case DIDLT_ALBUMART:
+                    if (LibUPnP::getLibUPnP()->m->reSanitizeURLs()) {
+                        addprop(name, reSanitizeURL(m_path.back().data));
                     } else {
                         addprop(name, m_path.back().data);
                     }
@@ -178,16 +269,33 @@ protected:
 
     void CharacterData(const XML_Char* s, int len) override
         {
-            if (s == 0 || *s == 0)
+            if (s == 0 || *s == 0 || m_skipdepth)
                 return;
             string str(s, len);
             m_path.back().data += str;
         }
 
 private:
+    const UPnPDirContent::Visitor& m_visitor;
+    bool m_stopped{false};
+    // The object being built. Handed over to the visitor, which may move from it, when complete,
+    // then reset by the next container or item start.
     UPnPDirObject m_tobj;
-    map<string, UPnPDirObject::ItemClass> m_okitems;
+    // Shared reference to the input text, for the items' DIDL fragments
+    std::shared_ptr<const string> m_buf;
     bool m_detailed;
+    // Field projection, only set if it does restrict something.
+    const UPnPDirProjection *m_proj{nullptr};
+    // m_path depth of the element we are skipping because of the projection, or 0.
+    size_t m_skipdepth{0};
+    static const string rootname;
+
+    void visit() {
+        if (!m_stopped && !m_visitor(m_tobj)) {
+            m_stopped = true;
+            XML_StopParser(expat_parser, XML_FALSE);
+        }
+    }
 
     void addprop(const string& nm, const string& data) {
         // e.g <upnp:artist role="AlbumArtist">Jojo</upnp:artist>
@@ -222,23 +330,108 @@ private:
 
 };
 
+const string UPnPDirParser::rootname("root");
+
+UPnPDirProjection::UPnPDirProjection(const string& spec, unsigned int maxres)
+    : m_all(false), m_maxres(maxres)
+{
+    vector<string> tokens;
+    stringToTokens(spec, tokens, ",");
+    m_filter.clear();
+    for (auto& token : tokens) {
+        trimstring(token);
+        if (token.empty()) {
+            continue;
+        }
+        if (token == "*") {
+            m_all = true;
+        } else if (token == "res") {
+            m_res = true;
+        } else if (token.compare(0, 4, "res@") == 0) {
+            m_res = true;
+            m_resattrs.insert(token.substr(4));
+        } else if (token[0] != '@') {
+            // "upnp:artist@role": we keep the property with all its attributes.
+            m_props.insert(token.substr(0, token.find('@')));
+        }
+        if (!m_filter.empty()) {
+            m_filter += ',';
+        }
+        m_filter += token;
+    }
+    if (m_all) {
+        m_filter = "*";
+    }
+}
+
+bool UPnPDirProjection::wantProp(const char *name) const
+{
+    if (m_all) {
+        return true;
+    }
+    // Required properties, used by the parser.
+    if (!strcmp(name, "dc:title") || !strcmp(name, "upnp:class")) {
+        return true;
+    }
+    return m_props.find(name) != m_props.end();
+}
+
+bool UPnPDirProjection::wantResAttr(const char *name) const
+{
+    if (m_all || m_resattrs.empty() || !strcmp(name, "protocolInfo")) {
+        return true;
+    }
+    return m_resattrs.find(name) != m_resattrs.end();
+}
+
+bool UPnPDirContent::parse(const std::string& input, bool detailed,
+                           const UPnPDirProjection *proj)
+{
+    return parse(string(input), detailed, proj);
+}
+
 bool UPnPDirContent::parse(const std::string& input, bool detailed)
+{
+    return parse(string(input), detailed, nullptr);
+}
+
+bool UPnPDirContent::parse(std::string&& input, bool detailed, const UPnPDirProjection *proj)
+{
+    return parseWithVisitor(
+        std::move(input),
+        [this] (UPnPDirObject& obj) {
+            if (obj.m_type == UPnPDirObject::container) {
+                m_containers.push_back(std::move(obj));
+            } else {
+                m_items.push_back(std::move(obj));
+            }
+            return true;
+        },
+        detailed, proj);
+}
+
+bool UPnPDirContent::parseWithVisitor(const std::string& input, const Visitor& visitor,
+                                      bool detailed, const UPnPDirProjection *proj)
+{
+    return parseWithVisitor(string(input), visitor, detailed, proj);
+}
+
+bool UPnPDirContent::parseWithVisitor(std::string&& input, const Visitor& visitor, bool detailed,
+                                      const UPnPDirProjection *proj)
 {
     if (input.empty()) {
         return false;
     }
-    const string *ipp = &input;
+    auto ipp = std::make_shared<string>(std::move(input));
 
     // Double-quoting happens. Just deal with it...
-    string unquoted;
-    if (input[0] == '&') {
-        LOGDEB0("UPnPDirContent::parse: unquoting over-quoted input: " << input << '\n');
-        unquoted = SoapHelp::xmlUnquote(input);
-        ipp = &unquoted;
+    if ((*ipp)[0] == '&') {
+        LOGDEB0("UPnPDirContent::parse: unquoting over-quoted input: " << *ipp << '\n');
+        SoapHelp::xmlUnquoteInPlace(*ipp);
     }
 
-    UPnPDirParser parser(*this, *ipp, detailed);
-    bool ret = parser.Parse();
+    UPnPDirParser parser(visitor, ipp, detailed, proj);
+    bool ret = parser.Parse() || parser.stoppedEarly();
     if (!ret) {
         LOGERR("UPnPDirContent::parse: parser failed: " << parser.getLastErrorMessage() <<
                " for:\n" << *ipp << '\n');
@@ -253,12 +446,893 @@ static const string didl_header(
     " xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\""
     " xmlns:dlna=\"urn:schemas-dlna-org:metadata-1-0/\">");
 static const string didl_close("</DIDL-Lite>");
+static const string item_close("</item>");
 
 // Maybe we'll do something about building didl from scratch if this
 // proves necessary.
 string UPnPDirObject::getdidl() const
 {
-    return didl_header + m_didlfrag + didl_close;
+    string out;
+    if (!m_didlbuf) {
+        out.reserve(didl_header.size() + didl_close.size());
+        out.append(didl_header).append(didl_close);
+        return out;
+    }
+    out.reserve(didl_header.size() + m_didllen + item_close.size() + didl_close.size());
+    out.append(didl_header).append(*m_didlbuf, m_didloff, m_didllen).append(item_close)
+        .append(didl_close);
+    return out;
+}
+
+
+class UPnPDirCompactContent::Internal {
+public:
+    Internal() {
+        clear();
+    }
+
+    // Property or resource attribute: interned name and value.
+    struct Prop {
+        uint16_t key;
+        uint32_t value;
+    };
+    struct Resource {
+        uint32_t uri;
+        uint32_t attrstart;
+        uint32_t attrcount;
+    };
+    // Object record. The properties and resources are slices of the flat arrays below.
+    struct Record {
+        uint32_t id;
+        uint32_t pid;
+        uint32_t title;
+        uint32_t propstart;
+        uint32_t resstart;
+        uint16_t propcount;
+        uint16_t rescount;
+        int8_t type;
+        int8_t iclass;
+    };
+
+    // String pool. Index 0 is the empty string. We use a deque because the element addresses
+    // are stable, so that the index can use views into the pool strings.
+    std::deque<string> strings;
+    std::unordered_map<std::string_view, uint32_t> stringids;
+    // Property and attribute names
+    vector<string> keys;
+    std::unordered_map<string, uint16_t> keyids;
+
+    vector<Prop> props;
+    vector<Resource> resources;
+    vector<Prop> rattrs;
+    vector<Record> containers;
+    vector<Record> items;
+
+    void clear() {
+        stringids.clear();
+        strings.clear();
+        strings.emplace_back();
+        stringids[strings.back()] = 0;
+        keys.clear();
+        keyids.clear();
+        props.clear();
+        resources.clear();
+        rattrs.clear();
+        containers.clear();
+        items.clear();
+    }
+
+    uint32_t intern(const string& s) {
+        auto it = stringids.find(s);
+        if (it != stringids.end()) {
+            return it->second;
+        }
+        uint32_t id = static_cast<uint32_t>(strings.size());
+        strings.push_back(s);
+        stringids[strings.back()] = id;
+        return id;
+    }
+
+    // Return false if we have too many distinct names (not expected to happen)
+    bool internkey(const string& nm, uint16_t *id) {
+        auto it = keyids.find(nm);
+        if (it != keyids.end()) {
+            *id = it->second;
+            return true;
+        }
+        if (keys.size() >= 0xffff) {
+            LOGERR("UPnPDirCompactContent: too many property names\n");
+            return false;
+        }
+        *id = static_cast<uint16_t>(keys.size());
+        keys.push_back(nm);
+        keyids[nm] = *id;
+        return true;
+    }
+
+    // Return -1 if the name is unknown
+    int findkey(const string& nm) const {
+        auto it = keyids.find(nm);
+        return it == keyids.end() ? -1 : it->second;
+    }
+
+    void addprops(const map<string, string>& in, vector<Prop>& out, uint32_t *start,
+                  uint32_t *count) {
+        *start = static_cast<uint32_t>(out.size());
+        for (const auto& [nm, value] : in) {
+            uint16_t key;
+            if (internkey(nm, &key)) {
+                out.push_back({key, intern(value)});
+            }
+        }
+        *count = static_cast<uint32_t>(out.size()) - *start;
+    }
+
+    const string *findprop(const vector<Prop>& in, uint32_t start, uint32_t count,
+                           const string& nm) const {
+        int key = findkey(nm);
+        if (key < 0) {
+            return nullptr;
+        }
+        for (uint32_t i = start; i < start + count; i++) {
+            if (in[i].key == key) {
+                return &strings[in[i].value];
+            }
+        }
+        return nullptr;
+    }
+
+    void add(const UPnPDirObject& obj) {
+        Record rec;
+        rec.id = intern(obj.m_id);
+        rec.pid = intern(obj.m_pid);
+        rec.title = intern(obj.m_title);
+        rec.type = static_cast<int8_t>(obj.m_type);
+        rec.iclass = static_cast<int8_t>(obj.m_iclass);
+        uint32_t count;
+        addprops(obj.m_props, props, &rec.propstart, &count);
+        rec.propcount = static_cast<uint16_t>(std::min(count, uint32_t(0xffff)));
+        rec.resstart = static_cast<uint32_t>(resources.size());
+        rec.rescount = static_cast<uint16_t>(std::min(obj.m_resources.size(), size_t(0xffff)));
+        for (unsigned int i = 0; i < rec.rescount; i++) {
+            const auto& res = obj.m_resources[i];
+            Resource cres;
+            cres.uri = intern(res.m_uri);
+            addprops(res.m_props, rattrs, &cres.attrstart, &cres.attrcount);
+            resources.push_back(cres);
+        }
+        if (obj.m_type == UPnPDirObject::container) {
+            containers.push_back(rec);
+        } else {
+            items.push_back(rec);
+        }
+    }
+};
+
+UPnPDirCompactContent::UPnPDirCompactContent()
+    : m(new Internal())
+{
+}
+
+UPnPDirCompactContent::~UPnPDirCompactContent()
+{
+    delete m;
+}
+
+bool UPnPDirCompactContent::parse(const std::string& didltext)
+{
+    return UPnPDirContent::parseWithVisitor(
+        didltext, [this] (UPnPDirObject& obj) {m->add(obj); return true;});
+}
+
+void UPnPDirCompactContent::add(const UPnPDirObject& obj)
+{
+    m->add(obj);
+}
+
+void UPnPDirCompactContent::add(const UPnPDirContent& dir)
+{
+    for (const auto& obj : dir.m_containers) {
+        m->add(obj);
+    }
+    for (const auto& obj : dir.m_items) {
+        m->add(obj);
+    }
+}
+
+size_t UPnPDirCompactContent::containerCount() const
+{
+    return m->containers.size();
+}
+
+size_t UPnPDirCompactContent::itemCount() const
+{
+    return m->items.size();
+}
+
+UPnPDirCompactContent::Object UPnPDirCompactContent::container(size_t idx) const
+{
+    return Object(this, true, idx);
+}
+
+UPnPDirCompactContent::Object UPnPDirCompactContent::item(size_t idx) const
+{
+    return Object(this, false, idx);
+}
+
+size_t UPnPDirCompactContent::stringCount() const
+{
+    return m->strings.size();
+}
+
+void UPnPDirCompactContent::clear()
+{
+    m->clear();
+}
+
+#define CREC() (m_container ? m_content->m->containers[m_idx] : m_content->m->items[m_idx])
+
+const string& UPnPDirCompactContent::Object::id() const
+{
+    return m_content->m->strings[CREC().id];
+}
+
+const string& UPnPDirCompactContent::Object::pid() const
+{
+    return m_content->m->strings[CREC().pid];
+}
+
+const string& UPnPDirCompactContent::Object::title() const
+{
+    return m_content->m->strings[CREC().title];
+}
+
+UPnPDirObject::ObjType UPnPDirCompactContent::Object::type() const
+{
+    return static_cast<UPnPDirObject::ObjType>(CREC().type);
+}
+
+UPnPDirObject::ItemClass UPnPDirCompactContent::Object::iclass() const
+{
+    return static_cast<UPnPDirObject::ItemClass>(CREC().iclass);
+}
+
+bool UPnPDirCompactContent::Object::getprop(const string& name, string& value) const
+{
+    const auto& rec = CREC();
+    const string *vp = m_content->m->findprop(m_content->m->props, rec.propstart, rec.propcount,
+                                              name);
+    if (nullptr == vp) {
+        return false;
+    }
+    value = *vp;
+    return true;
+}
+
+const string& UPnPDirCompactContent::Object::getprop(const string& name) const
+{
+    const auto& rec = CREC();
+    const string *vp = m_content->m->findprop(m_content->m->props, rec.propstart, rec.propcount,
+                                              name);
+    return vp ? *vp : m_content->m->strings[0];
+}
+
+void UPnPDirCompactContent::Object::forEachProp(
+    const std::function<void (const string&, const string&)>& f) const
+{
+    const auto& rec = CREC();
+    for (uint32_t i = rec.propstart; i < rec.propstart + rec.propcount; i++) {
+        const auto& prop = m_content->m->props[i];
+        f(m_content->m->keys[prop.key], m_content->m->strings[prop.value]);
+    }
+}
+
+unsigned int UPnPDirCompactContent::Object::resourceCount() const
+{
+    return CREC().rescount;
+}
+
+const string& UPnPDirCompactContent::Object::resourceUri(unsigned int ridx) const
+{
+    const auto& rec = CREC();
+    if (ridx >= rec.rescount) {
+        return m_content->m->strings[0];
+    }
+    return m_content->m->strings[m_content->m->resources[rec.resstart + ridx].uri];
+}
+
+bool UPnPDirCompactContent::Object::getrprop(unsigned int ridx, const string& nm,
+                                             string& val) const
+{
+    const auto& rec = CREC();
+    if (ridx >= rec.rescount) {
+        return false;
+    }
+    const auto& res = m_content->m->resources[rec.resstart + ridx];
+    const string *vp = m_content->m->findprop(m_content->m->rattrs, res.attrstart, res.attrcount,
+                                              nm);
+    if (nullptr == vp) {
+        return false;
+    }
+    val = *vp;
+    return true;
+}
+
+int UPnPDirCompactContent::Object::getDurationSeconds(unsigned ridx) const
+{
+    string sdur;
+    if (!getrprop(ridx, "duration", sdur)) {
+        //?? Avoid returning 0, who knows...
+        return 1;
+    }
+    return UPnPP::upnpdurationtos(sdur);
 }
 
+UPnPDirObject UPnPDirCompactContent::Object::toDirObject() const
+{
+    const auto& rec = CREC();
+    const auto& strings = m_content->m->strings;
+    const auto& keys = m_content->m->keys;
+    UPnPDirObject obj;
+    obj.m_id = strings[rec.id];
+    obj.m_pid = strings[rec.pid];
+    obj.m_title = strings[rec.title];
+    obj.m_type = type();
+    obj.m_iclass = iclass();
+    forEachProp([&obj](const string& nm, const string& value) {obj.m_props[nm] = value;});
+    for (unsigned int i = 0; i < rec.rescount; i++) {
+        const auto& cres = m_content->m->resources[rec.resstart + i];
+        UPnPResource res;
+        res.m_uri = strings[cres.uri];
+        for (uint32_t j = cres.attrstart; j < cres.attrstart + cres.attrcount; j++) {
+            const auto& attr = m_content->m->rattrs[j];
+            res.m_props[keys[attr.key]] = strings[attr.value];
+        }
+        obj.m_resources.push_back(std::move(res));
+    }
+    return obj;
+}
+
+#undef CREC
+
+/* Binary file format for UPnPDirCompactContent::save() and UPnPDirMappedContent. All the
+ * values are in the native byte order. The sections are 8-bytes aligned, the offsets in the
+ * header are from the start of the file. The string table holds the pool strings followed by
+ * the property names, each string is NUL-terminated, and its offset in the data is given by
+ * an array of nstrings+1 uint32 (the last one is the data size). */
+static const char dirfile_magic[8] = {'U', 'P', 'P', 'D', 'I', 'R', 'C', '\0'};
+static const uint32_t dirfile_version = 1;
+static const uint32_t dirfile_byteorder = 0x01020304;
+
+struct DirFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;
+    uint32_t nstrings;
+    uint32_t nkeys;
+    uint32_t nprops;
+    uint32_t nresources;
+    uint32_t nrattrs;
+    uint32_t ncontainers;
+    uint32_t nitems;
+    uint32_t pad;
+    // Section offsets
+    uint64_t stroffs;
+    uint64_t strdata;
+    uint64_t strdatasize;
+    uint64_t keys;
+    uint64_t props;
+    uint64_t resources;
+    uint64_t rattrs;
+    uint64_t containers;
+    uint64_t items;
+    uint64_t filesize;
+};
+struct DirFileProp {
+    uint32_t key;
+    uint32_t value;
+};
+struct DirFileResource {
+    uint32_t uri;
+    uint32_t attrstart;
+    uint32_t attrcount;
+};
+struct DirFileRecord {
+    uint32_t id;
+    uint32_t pid;
+    uint32_t title;
+    uint32_t propstart;
+    uint32_t resstart;
+    uint16_t propcount;
+    uint16_t rescount;
+    int8_t type;
+    int8_t iclass;
+    uint8_t pad[2];
+};
+static_assert(sizeof(DirFileHeader) == 128, "bad DirFileHeader size");
+static_assert(sizeof(DirFileProp) == 8, "bad DirFileProp size");
+static_assert(sizeof(DirFileResource) == 12, "bad DirFileResource size");
+static_assert(sizeof(DirFileRecord) == 28, "bad DirFileRecord size");
+
+// Write a section, padded to 8 bytes, and return its offset.
+static uint64_t writeSection(std::ofstream& out, const void *data, size_t size)
+{
+    static const char zeros[8]{};
+    uint64_t offset = static_cast<uint64_t>(out.tellp());
+    out.write(static_cast<const char *>(data), size);
+    if (size % 8) {
+        out.write(zeros, 8 - size % 8);
+    }
+    return offset;
+}
+
+bool UPnPDirCompactContent::save(const string& path) const
+{
+    DirFileHeader header{};
+    memcpy(header.magic, dirfile_magic, sizeof(header.magic));
+    header.version = dirfile_version;
+    header.byteorder = dirfile_byteorder;
+
+    // String table: pool strings, then the key names.
+    vector<uint32_t> stroffs;
+    string strdata;
+    stroffs.reserve(m->strings.size() + m->keys.size() + 1);
+    auto addstring = [&stroffs, &strdata](const string& str) {
+        stroffs.push_back(static_cast<uint32_t>(strdata.size()));
+        strdata.append(str).append(1, '\0');
+    };
+    for (const auto& str : m->strings) {
+        addstring(str);
+    }
+    vector<uint32_t> keys;
+    for (const auto& key : m->keys) {
+        keys.push_back(static_cast<uint32_t>(stroffs.size()));
+        addstring(key);
+    }
+    if (strdata.size() > 0xffffffffu) {
+        LOGERR("UPnPDirCompactContent::save: too much string data\n");
+        return false;
+    }
+    stroffs.push_back(static_cast<uint32_t>(strdata.size()));
+    header.nstrings = static_cast<uint32_t>(stroffs.size() - 1);
+    header.nkeys = static_cast<uint32_t>(keys.size());
+
+    vector<DirFileProp> props;
+    props.reserve(m->props.size());
+    for (const auto& prop : m->props) {
+        props.push_back({prop.key, prop.value});
+    }
+    vector<DirFileProp> rattrs;
+    rattrs.reserve(m->rattrs.size());
+    for (const auto& prop : m->rattrs) {
+        rattrs.push_back({prop.key, prop.value});
+    }
+    vector<DirFileResource> resources;
+    resources.reserve(m->resources.size());
+    for (const auto& res : m->resources) {
+        resources.push_back({res.uri, res.attrstart, res.attrcount});
+    }
+    auto torecords = [](const vector<Internal::Record>& in) {
+        vector<DirFileRecord> out;
+        out.reserve(in.size());
+        for (const auto& rec : in) {
+            DirFileRecord frec{};
+            frec.id = rec.id;
+            frec.pid = rec.pid;
+            frec.title = rec.title;
+            frec.propstart = rec.propstart;
+            frec.resstart = rec.resstart;
+            frec.propcount = rec.propcount;
+            frec.rescount = rec.rescount;
+            frec.type = rec.type;
+            frec.iclass = rec.iclass;
+            out.push_back(frec);
+        }
+        return out;
+    };
+    vector<DirFileRecord> containers = torecords(m->containers);
+    vector<DirFileRecord> items = torecords(m->items);
+    header.nprops = static_cast<uint32_t>(props.size());
+    header.nresources = static_cast<uint32_t>(resources.size());
+    header.nrattrs = static_cast<uint32_t>(rattrs.size());
+    header.ncontainers = static_cast<uint32_t>(containers.size());
+    header.nitems = static_cast<uint32_t>(items.size());
+
+    string tmppath = path + ".tmp";
+    std::ofstream out(tmppath, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!out.is_open()) {
+        LOGERR("UPnPDirCompactContent::save: can't open " << tmppath << "\n");
+        return false;
+    }
+    // Header placeholder, rewritten at the end
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    header.stroffs = writeSection(out, stroffs.data(), stroffs.size() * sizeof(uint32_t));
+    header.strdata = writeSection(out, strdata.data(), strdata.size());
+    header.strdatasize = strdata.size();
+    header.keys = writeSection(out, keys.data(), keys.size() * sizeof(uint32_t));
+    header.props = writeSection(out, props.data(), props.size() * sizeof(DirFileProp));
+    header.resources = writeSection(out, resources.data(),
+                                    resources.size() * sizeof(DirFileResource));
+    header.rattrs = writeSection(out, rattrs.data(), rattrs.size() * sizeof(DirFileProp));
+    header.containers = writeSection(out, containers.data(),
+                                     containers.size() * sizeof(DirFileRecord));
+    header.items = writeSection(out, items.data(), items.size() * sizeof(DirFileRecord));
+    header.filesize = static_cast<uint64_t>(out.tellp());
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.close();
+    if (out.fail()) {
+        LOGERR("UPnPDirCompactContent::save: write failed for " << tmppath << "\n");
+        remove(tmppath.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    // Windows rename() does not replace an existing file
+    remove(path.c_str());
+#endif
+    if (rename(tmppath.c_str(), path.c_str()) != 0) {
+        LOGERR("UPnPDirCompactContent::save: can't rename " << tmppath << " to " << path <<
+               "\n");
+        remove(tmppath.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+class UPnPDirMappedContent::Internal {
+public:
+    ~Internal() {
+        close();
+    }
+
+    const char *base{nullptr};
+    size_t size{0};
+#ifdef _WIN32
+    // No mmap: we read the file in memory
+    string data;
+#endif
+    const DirFileHeader *header{nullptr};
+    const uint32_t *stroffs{nullptr};
+    const char *strdata{nullptr};
+    const DirFileProp *props{nullptr};
+    const DirFileResource *resources{nullptr};
+    const DirFileProp *rattrs{nullptr};
+    const DirFileRecord *containers{nullptr};
+    const DirFileRecord *items{nullptr};
+    // Property name -> key. The names are few, this is built when opening.
+    std::unordered_map<std::string_view, uint32_t> keyids;
+    vector<std::string_view> keys;
+
+    void close() {
+#ifdef _WIN32
+        data.clear();
+#else
+        if (base) {
+            munmap(const_cast<char *>(base), size);
+        }
+#endif
+        base = nullptr;
+        size = 0;
+        header = nullptr;
+        keyids.clear();
+        keys.clear();
+    }
+
+    bool map(const string& path) {
+#ifdef _WIN32
+        std::ifstream in(path, std::ios::in | std::ios::binary);
+        if (!in.is_open()) {
+            return false;
+        }
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        base = data.data();
+        size = data.size();
+        return true;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+        void *addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+        base = static_cast<const char *>(addr);
+        size = static_cast<size_t>(st.st_size);
+        return true;
+#endif
+    }
+
+    // Check that a section is inside the file and aligned, and return its address.
+    template <class T> bool section(uint64_t offset, uint64_t count, const T **ptr) const {
+        if (offset % alignof(T) || offset > size || count > (size - offset) / sizeof(T)) {
+            return false;
+        }
+        *ptr = reinterpret_cast<const T *>(base + offset);
+        return true;
+    }
+
+    bool setup() {
+        if (size < sizeof(DirFileHeader)) {
+            return false;
+        }
+        header = reinterpret_cast<const DirFileHeader *>(base);
+        if (memcmp(header->magic, dirfile_magic, sizeof(dirfile_magic)) ||
+            header->version != dirfile_version || header->byteorder != dirfile_byteorder ||
+            header->filesize != size || header->nstrings == 0) {
+            return false;
+        }
+        const uint32_t *keyidx;
+        if (!section(header->stroffs, uint64_t(header->nstrings) + 1, &stroffs) ||
+            !section(header->strdata, header->strdatasize, &strdata) ||
+            !section(header->keys, header->nkeys, &keyidx) ||
+            !section(header->props, header->nprops, &props) ||
+            !section(header->resources, header->nresources, &resources) ||
+            !section(header->rattrs, header->nrattrs, &rattrs) ||
+            !section(header->containers, header->ncontainers, &containers) ||
+            !section(header->items, header->nitems, &items) ||
+            stroffs[header->nstrings] != header->strdatasize) {
+            return false;
+        }
+        for (uint32_t i = 0; i < header->nkeys; i++) {
+            keys.push_back(str(keyidx[i]));
+            keyids[keys.back()] = i;
+        }
+        return true;
+    }
+
+    // The string accessors check the indexes, so that a damaged file can't make us read
+    // outside of the mapping.
+    std::string_view str(uint32_t idx) const {
+        if (nullptr == header || idx >= header->nstrings) {
+            return std::string_view();
+        }
+        uint32_t start = stroffs[idx], end = stroffs[idx + 1];
+        if (start >= end || end > header->strdatasize) {
+            return std::string_view();
+        }
+        return std::string_view(strdata + start, end - start - 1);
+    }
+
+    std::string_view keyname(uint32_t key) const {
+        return key < keys.size() ? keys[key] : std::string_view();
+    }
+
+    // Returns an empty record for an index out of range.
+    const DirFileRecord& record(bool container, size_t idx) const {
+        static const DirFileRecord emptyrec{0, 0, 0, 0, 0, 0, 0, UPnPDirObject::objtnone,
+                                            UPnPDirObject::ITC_unknown, {0, 0}};
+        if (nullptr == header || idx >= (container ? header->ncontainers : header->nitems)) {
+            return emptyrec;
+        }
+        return container ? containers[idx] : items[idx];
+    }
+
+    // Check that [start, start+count) is inside the table the size of which is the header
+    // field @param n. False if no file is open.
+    bool inRange(uint32_t DirFileHeader::*n, uint32_t start, uint32_t count) const {
+        if (nullptr == header) {
+            return false;
+        }
+        uint32_t nin = header->*n;
+        return start <= nin && count <= nin - start;
+    }
+
+    bool findprop(const DirFileProp *in, uint32_t DirFileHeader::*n, uint32_t start,
+                  uint32_t count, const string& nm, std::string_view *value) const {
+        if (!inRange(n, start, count)) {
+            return false;
+        }
+        auto it = keyids.find(nm);
+        if (it == keyids.end()) {
+            return false;
+        }
+        for (uint32_t i = start; i < start + count; i++) {
+            if (in[i].key == it->second) {
+                *value = str(in[i].value);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const DirFileResource *resource(const DirFileRecord& rec, unsigned int ridx) const {
+        if (ridx >= rec.rescount || !inRange(&DirFileHeader::nresources, rec.resstart, ridx + 1)) {
+            return nullptr;
+        }
+        return &resources[rec.resstart + ridx];
+    }
+};
+
+UPnPDirMappedContent::UPnPDirMappedContent()
+    : m(new Internal())
+{
+}
+
+UPnPDirMappedContent::~UPnPDirMappedContent()
+{
+    delete m;
+}
+
+bool UPnPDirMappedContent::open(const string& path)
+{
+    m->close();
+    if (!m->map(path)) {
+        LOGERR("UPnPDirMappedContent::open: can't open/map " << path << "\n");
+        return false;
+    }
+    if (!m->setup()) {
+        LOGERR("UPnPDirMappedContent::open: bad format for " << path << "\n");
+        m->close();
+        return false;
+    }
+    return true;
+}
+
+void UPnPDirMappedContent::close()
+{
+    m->close();
+}
+
+bool UPnPDirMappedContent::ok() const
+{
+    return m->header != nullptr;
+}
+
+size_t UPnPDirMappedContent::containerCount() const
+{
+    return m->header ? m->header->ncontainers : 0;
+}
+
+size_t UPnPDirMappedContent::itemCount() const
+{
+    return m->header ? m->header->nitems : 0;
+}
+
+UPnPDirMappedContent::Object UPnPDirMappedContent::container(size_t idx) const
+{
+    return Object(this, true, idx);
+}
+
+UPnPDirMappedContent::Object UPnPDirMappedContent::item(size_t idx) const
+{
+    return Object(this, false, idx);
+}
+
+#define MINT() (m_content->m)
+#define MREC() (MINT()->record(m_container, m_idx))
+
+std::string_view UPnPDirMappedContent::Object::id() const
+{
+    return MINT()->str(MREC().id);
+}
+
+std::string_view UPnPDirMappedContent::Object::pid() const
+{
+    return MINT()->str(MREC().pid);
+}
+
+std::string_view UPnPDirMappedContent::Object::title() const
+{
+    return MINT()->str(MREC().title);
+}
+
+UPnPDirObject::ObjType UPnPDirMappedContent::Object::type() const
+{
+    return static_cast<UPnPDirObject::ObjType>(MREC().type);
+}
+
+UPnPDirObject::ItemClass UPnPDirMappedContent::Object::iclass() const
+{
+    return static_cast<UPnPDirObject::ItemClass>(MREC().iclass);
+}
+
+bool UPnPDirMappedContent::Object::getprop(const string& name, string& value) const
+{
+    const auto& rec = MREC();
+    std::string_view vw;
+    if (!MINT()->findprop(MINT()->props, &DirFileHeader::nprops, rec.propstart, rec.propcount,
+                          name, &vw)) {
+        return false;
+    }
+    value.assign(vw.data(), vw.size());
+    return true;
+}
+
+std::string_view UPnPDirMappedContent::Object::getprop(const string& name) const
+{
+    const auto& rec = MREC();
+    std::string_view vw;
+    MINT()->findprop(MINT()->props, &DirFileHeader::nprops, rec.propstart, rec.propcount,
+                     name, &vw);
+    return vw;
+}
+
+void UPnPDirMappedContent::Object::forEachProp(
+    const std::function<void (std::string_view, std::string_view)>& f) const
+{
+    const auto& rec = MREC();
+    if (!MINT()->inRange(&DirFileHeader::nprops, rec.propstart, rec.propcount)) {
+        return;
+    }
+    for (uint32_t i = rec.propstart; i < rec.propstart + rec.propcount; i++) {
+        const auto& prop = MINT()->props[i];
+        f(MINT()->keyname(prop.key), MINT()->str(prop.value));
+    }
+}
+
+unsigned int UPnPDirMappedContent::Object::resourceCount() const
+{
+    return MREC().rescount;
+}
+
+std::string_view UPnPDirMappedContent::Object::resourceUri(unsigned int ridx) const
+{
+    const DirFileResource *res = MINT()->resource(MREC(), ridx);
+    return res ? MINT()->str(res->uri) : std::string_view();
+}
+
+bool UPnPDirMappedContent::Object::getrprop(unsigned int ridx, const string& nm,
+                                            string& val) const
+{
+    const DirFileResource *res = MINT()->resource(MREC(), ridx);
+    std::string_view vw;
+    if (nullptr == res || !MINT()->findprop(MINT()->rattrs, &DirFileHeader::nrattrs,
+                                            res->attrstart, res->attrcount, nm, &vw)) {
+        return false;
+    }
+    val.assign(vw.data(), vw.size());
+    return true;
+}
+
+int UPnPDirMappedContent::Object::getDurationSeconds(unsigned ridx) const
+{
+    string sdur;
+    if (!getrprop(ridx, "duration", sdur)) {
+        //?? Avoid returning 0, who knows...
+        return 1;
+    }
+    return UPnPP::upnpdurationtos(sdur);
+}
+
+UPnPDirObject UPnPDirMappedContent::Object::toDirObject() const
+{
+    const auto& rec = MREC();
+    UPnPDirObject obj;
+    obj.m_id = id();
+    obj.m_pid = pid();
+    obj.m_title = title();
+    obj.m_type = type();
+    obj.m_iclass = iclass();
+    forEachProp([&obj](std::string_view nm, std::string_view value) {
+        obj.m_props[string(nm)] = value;
+    });
+    for (unsigned int i = 0; i < rec.rescount; i++) {
+        const DirFileResource *cres = MINT()->resource(rec, i);
+        if (nullptr == cres) {
+            break;
+        }
+        UPnPResource res;
+        res.m_uri = MINT()->str(cres->uri);
+        if (MINT()->inRange(&DirFileHeader::nrattrs, cres->attrstart, cres->attrcount)) {
+            for (uint32_t j = cres->attrstart; j < cres->attrstart + cres->attrcount; j++) {
+                const auto& attr = MINT()->rattrs[j];
+                res.m_props[string(MINT()->keyname(attr.key))] = MINT()->str(attr.value);
+            }
+        }
+        obj.m_resources.push_back(std::move(res));
+    }
+    return obj;
+}
+
+#undef MREC
+#undef MINT
+
 } // namespace
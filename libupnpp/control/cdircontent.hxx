@@ -18,10 +18,13 @@
 #ifndef _UPNPDIRCONTENT_H_X_INCLUDED_
 #define _UPNPDIRCONTENT_H_X_INCLUDED_
 
+#include <functional>
 #include <map>
 #include <memory>
+#include <set>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 #include <memory>
@@ -228,6 +231,22 @@ public:
      */
     std::string getdidl() const;
 
+    /**
+     * Drop the reference to the DIDL text we were parsed from. This is shared by all the
+     * objects from a parse, so it stays in memory as long as any of them does. Call this on
+     * objects kept for a long time when getdidl() will not be needed: it will then return an
+     * empty document.
+     */
+    void releaseDidl() {
+        m_didlbuf.reset();
+        m_didloff = m_didllen = 0;
+    }
+
+    /** Return the size of our element in the DIDL text we refer to, 0 if released. */
+    size_t didlSize() const {
+        return m_didllen;
+    }
+
     void clear(bool detailed=false) {
         m_id.clear();
         m_pid.clear();
@@ -241,7 +260,8 @@ public:
             m_allprops = std::shared_ptr<PropertyMap>();
         }
         m_resources.clear();
-        m_didlfrag.clear();
+        m_didlbuf.reset();
+        m_didloff = m_didllen = 0;
     }
 
     std::string dump() const {
@@ -268,11 +288,69 @@ public:
 
 private:
     friend class UPnPDirParser;
-    // DIDL text for element, sans header
-    std::string m_didlfrag;
+    // DIDL text for element, sans header and closing tag. This is a reference to the document we
+    // were parsed from, which is shared by all the objects from the same parse, with the offset
+    // and length of our element. The text is only copied if getdidl() is called.
+    std::shared_ptr<const std::string> m_didlbuf;
+    size_t m_didloff{0};
+    size_t m_didllen{0};
     static std::string nullstr;
 };
 
+/**
+ * Field projection for DIDL parsing: the set of properties and resource data which should be
+ * stored in the UPnPDirObject entries. Everything else is skipped by the parser, which saves
+ * time and memory when only a few fields are used, e.g. for a list display.
+ *
+ * The spec uses the same syntax as the UPnP ContentDirectory Browse/Search Filter argument: a
+ * comma-separated list of property names ("dc:title,upnp:artist,res,res@duration"), or "*" for
+ * everything. The object id, parent id, title and class are always kept, whatever the spec.
+ * "res" selects the resources. If "res@xxx" attributes are listed, only these and protocolInfo
+ * are kept for the resources, else all the resource attributes are kept. Other attribute
+ * specifications ("@childCount", "upnp:artist@role") are accepted but do not restrict anything.
+ */
+class UPNPP_API UPnPDirProjection {
+public:
+    /** Default: keep everything */
+    UPnPDirProjection() {}
+
+    /**
+     * @param spec comma-separated list of property names, or "*".
+     * @param maxres maximum number of resources to keep for each object (e.g. 1 if only the
+     *    first URI is used). 0 for no limit.
+     */
+    explicit UPnPDirProjection(const std::string& spec, unsigned int maxres = 0);
+
+    /** Return the spec as a Filter string usable in a ContentDirectory request */
+    const std::string& filter() const {
+        return m_filter;
+    }
+    /** True if nothing is filtered out */
+    bool all() const {
+        return m_all && m_maxres == 0;
+    }
+    /** Should the named property (element name e.g. "upnp:artist") be kept ? */
+    bool wantProp(const char *name) const;
+    /** Should resources be kept at all ? */
+    bool wantRes() const {
+        return m_all || m_res;
+    }
+    /** Should the named resource attribute be kept ? */
+    bool wantResAttr(const char *name) const;
+    /** Max number of resources per object, 0 for no limit */
+    unsigned int maxResources() const {
+        return m_maxres;
+    }
+
+private:
+    std::string m_filter{"*"};
+    bool m_all{true};
+    bool m_res{false};
+    unsigned int m_maxres{0};
+    std::set<std::string, std::less<>> m_props;
+    std::set<std::string, std::less<>> m_resattrs;
+};
+
 /**
  * Image of a MediaServer Directory Service container (directory),
  * possibly containing items and subordinate containers.
@@ -302,8 +380,206 @@ public:
      * up...
      *
      * @param detailed if true, populate the m_allprops field.
+     * @param proj if set, only store the fields selected by the projection.
      */
+    bool parse(const std::string& didltext, bool detailed,
+               const UPnPDirProjection *proj);
+    /** Same as above, without projection. Kept for binary compatibility. */
     bool parse(const std::string& didltext, bool detailed = false);
+
+    /** Same as above, but take ownership of the data instead of copying it. The items keep a
+     * reference to the text, for getdidl(). */
+    bool parse(std::string&& didltext, bool detailed = false,
+               const UPnPDirProjection *proj = nullptr);
+
+    /** Type of the function called by parseWithVisitor() for each complete object. The visitor
+     * may move the data out of the object, which will not be used by the parser any more.
+     * Return false to stop the parse. */
+    typedef std::function<bool (UPnPDirObject&)> Visitor;
+
+    /**
+     * Streaming parse from DIDL-Lite XML data.
+     *
+     * Instead of accumulating the entries in an UPnPDirContent, call @param visitor for each
+     * container or item, as soon as its closing tag is seen, in document order. The visitor can
+     * stop the parse, which is not considered an error.
+     *
+     * @param detailed if true, populate the m_allprops field.
+     * @param proj if set, only store the fields selected by the projection.
+     * @return false if the data could not be parsed. Objects may have been visited before the
+     *    error was detected.
+     */
+    static bool parseWithVisitor(const std::string& didltext, const Visitor& visitor,
+                                 bool detailed = false, const UPnPDirProjection *proj = nullptr);
+    /** Same as above, but take ownership of the data instead of copying it. */
+    static bool parseWithVisitor(std::string&& didltext, const Visitor& visitor,
+                                 bool detailed = false, const UPnPDirProjection *proj = nullptr);
+};
+
+/**
+ * Compact alternative to UPnPDirContent, for holding many objects, e.g. the result of a full
+ * library crawl.
+ *
+ * Property names are interned as small integers, and all the string values (ids, titles,
+ * property values, URIs, resource attributes) are stored once in a string pool owned by the
+ * object, so that repeated values (the same artist or album across many tracks) cost little.
+ * The properties and resource attributes of all the objects are stored in flat arrays.
+ *
+ * Only the basic/compat property storage (UPnPDirObject::m_props) is kept: no m_allprops, and no
+ * original DIDL text. Objects are accessed through lightweight Object handles which have the same
+ * accessors as UPnPDirObject, and can be converted back to an UPnPDirObject if needed. The
+ * handles are only valid while the UPnPDirCompactContent object exists, but they are not
+ * invalidated by adding more objects.
+ */
+class UPNPP_API UPnPDirCompactContent {
+public:
+    UPnPDirCompactContent();
+    ~UPnPDirCompactContent();
+    UPnPDirCompactContent(const UPnPDirCompactContent&) = delete;
+    UPnPDirCompactContent& operator=(const UPnPDirCompactContent&) = delete;
+
+    /** Handle to one object stored inside an UPnPDirCompactContent */
+    class UPNPP_API Object {
+    public:
+        const std::string& id() const;
+        const std::string& pid() const;
+        const std::string& title() const;
+        UPnPDirObject::ObjType type() const;
+        UPnPDirObject::ItemClass iclass() const;
+
+        /** Get named property. See UPnPDirObject::getprop() */
+        bool getprop(const std::string& name, std::string& value) const;
+        /** Get named property, or an empty string. See UPnPDirObject::getprop() */
+        const std::string& getprop(const std::string& name) const;
+        /** Call @param f with each name/value property pair */
+        void forEachProp(
+            const std::function<void (const std::string&, const std::string&)>& f) const;
+
+        /** Number of resources */
+        unsigned int resourceCount() const;
+        /** URI for the resource at index ridx, or an empty string */
+        const std::string& resourceUri(unsigned int ridx) const;
+        /** Get named resource attribute. See UPnPDirObject::getrprop() */
+        bool getrprop(unsigned int ridx, const std::string& nm, std::string& val) const;
+        /** Resource duration in seconds. See UPnPDirObject::getDurationSeconds() */
+        int getDurationSeconds(unsigned ridx = 0) const;
+
+        /** Build an independent UPnPDirObject with the same data (no DIDL text) */
+        UPnPDirObject toDirObject() const;
+
+    private:
+        friend class UPnPDirCompactContent;
+        Object(const UPnPDirCompactContent *content, bool container, size_t idx)
+            : m_content(content), m_container(container), m_idx(idx) {}
+        const UPnPDirCompactContent *m_content;
+        bool m_container;
+        size_t m_idx;
+    };
+
+    /** Parse from DIDL-Lite XML data. Cumulative, like UPnPDirContent::parse() */
+    bool parse(const std::string& didltext);
+
+    /** Add a copy of an object */
+    void add(const UPnPDirObject& obj);
+    /** Add a copy of all the objects in an UPnPDirContent */
+    void add(const UPnPDirContent& dir);
+
+    size_t containerCount() const;
+    size_t itemCount() const;
+    Object container(size_t idx) const;
+    Object item(size_t idx) const;
+
+    /** Number of distinct strings in the pool (for statistics) */
+    size_t stringCount() const;
+
+    void clear();
+
+    /** Write the contents to a file, in the binary format read by UPnPDirMappedContent.
+     * The data is written to a temporary file which is then renamed, so that a process which
+     * has the old file open keeps a consistent view.
+     * @return false for an error. */
+    bool save(const std::string& path) const;
+
+private:
+    class UPNPP_LOCAL Internal;
+    Internal *m;
+};
+
+/**
+ * Read-only access to a file written by UPnPDirCompactContent::save(), e.g. a crawled library
+ * cached on disk.
+ *
+ * The file is mapped in memory and used in place: opening it costs almost nothing whatever its
+ * size, the data is only paged in when it is accessed, and the memory is shared by all the
+ * processes which open the same file. The file holds a string table, fixed-width object
+ * records, and flat property, resource and resource attribute tables.
+ *
+ * The Object handles have the same accessors as UPnPDirCompactContent::Object, but the strings
+ * are returned as views into the mapped data. The handles and views are only valid while the
+ * file is open. The file uses the native byte order, and is refused by a machine with a
+ * different one.
+ */
+class UPNPP_API UPnPDirMappedContent {
+public:
+    UPnPDirMappedContent();
+    ~UPnPDirMappedContent();
+    UPnPDirMappedContent(const UPnPDirMappedContent&) = delete;
+    UPnPDirMappedContent& operator=(const UPnPDirMappedContent&) = delete;
+
+    /** Handle to one object inside the mapped file */
+    class UPNPP_API Object {
+    public:
+        std::string_view id() const;
+        std::string_view pid() const;
+        std::string_view title() const;
+        UPnPDirObject::ObjType type() const;
+        UPnPDirObject::ItemClass iclass() const;
+
+        /** Get named property. See UPnPDirObject::getprop() */
+        bool getprop(const std::string& name, std::string& value) const;
+        /** Get named property, or an empty view. */
+        std::string_view getprop(const std::string& name) const;
+        /** Call @param f with each name/value property pair */
+        void forEachProp(const std::function<void (std::string_view, std::string_view)>& f)
+            const;
+
+        /** Number of resources */
+        unsigned int resourceCount() const;
+        /** URI for the resource at index ridx, or an empty view */
+        std::string_view resourceUri(unsigned int ridx) const;
+        /** Get named resource attribute. See UPnPDirObject::getrprop() */
+        bool getrprop(unsigned int ridx, const std::string& nm, std::string& val) const;
+        /** Resource duration in seconds. See UPnPDirObject::getDurationSeconds() */
+        int getDurationSeconds(unsigned ridx = 0) const;
+
+        /** Build an independent UPnPDirObject with the same data (no DIDL text) */
+        UPnPDirObject toDirObject() const;
+
+    private:
+        friend class UPnPDirMappedContent;
+        Object(const UPnPDirMappedContent *content, bool container, size_t idx)
+            : m_content(content), m_container(container), m_idx(idx) {}
+        const UPnPDirMappedContent *m_content;
+        bool m_container;
+        size_t m_idx;
+    };
+
+    /** Open and map a file. Any previously opened file is closed.
+     * @return false if the file can't be opened or is not in the right format. */
+    bool open(const std::string& path);
+    /** Close the file. The Object handles become invalid. */
+    void close();
+    /** Check if a file is open */
+    bool ok() const;
+
+    size_t containerCount() const;
+    size_t itemCount() const;
+    Object container(size_t idx) const;
+    Object item(size_t idx) const;
+
+private:
+    class UPNPP_LOCAL Internal;
+    Internal *m;
 };
 
 } // namespace
@@ -0,0 +1,354 @@
+/* Copyright (C) 2024 J.F.Dockes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301 USA
+ */
+#include "config.h"
+
+#include "libupnpp/control/cdircrawler.hxx"
+
+#include <upnp.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "libupnpp/log.hxx"
+
+using namespace std;
+
+namespace UPnPClient {
+
+static const string updateidprop{"upnp:containerUpdateID"};
+
+class CDCrawler::Internal {
+public:
+    // Stored children for a container.
+    struct Node {
+        // upnp:containerUpdateID when the children were read. Empty if not supported.
+        string updateid;
+        vector<UPnPDirObject> containers;
+        vector<UPnPDirObject> items;
+    };
+    struct Task {
+        string id;
+        // Current upnp:containerUpdateID value, from the parent listing or the metadata.
+        string updateid;
+    };
+
+    CDSH server;
+    int nthreads;
+    UPnPDirProjection proj;
+    const UPnPDirProjection *projp{nullptr};
+    // Index: container id -> children
+    unordered_map<string, Node> nodes;
+    // SystemUpdateID for the index. Not valid if hasupdateid is false.
+    int sysupdateid{0};
+    bool hasupdateid{false};
+    Stats stats;
+    // Current upnp:containerUpdateID for all the containers, from a single search at the start
+    // of the crawl. Only valid if hascurupdateids is true. Read-only during the walk.
+    unordered_map<string, string> curupdateids;
+    bool hascurupdateids{false};
+
+    // State for the current crawl. The old index (nodes) is only read during the walk.
+    mutex mtx;
+    condition_variable cond;
+    deque<Task> queue;
+    unordered_set<string> seen;
+    unordered_map<string, Node> newnodes;
+    int active{0};
+    int firsterror{UPNP_E_SUCCESS};
+
+    // Queue a container, if it was not already reached through another path.
+    void pushTask(Task&& task) {
+        if (!seen.insert(task.id).second) {
+            return;
+        }
+        queue.push_back(std::move(task));
+        cond.notify_one();
+    }
+
+    void recordError(const string& id, int ret) {
+        LOGINF("CDCrawler: can't read container " << id << " error " << ret << "\n");
+        std::unique_lock<std::mutex> lock(mtx);
+        stats.errors++;
+        if (firsterror == UPNP_E_SUCCESS) {
+            firsterror = ret;
+        }
+    }
+
+    // Read the children of a container. Returns the new node, with the tasks for its child
+    // containers.
+    bool readNode(const Task& task, Node& node, vector<Task>& tasks) {
+        UPnPDirContent dir;
+        int ret = server->readDir(task.id, dir, projp);
+        if (ret != UPNP_E_SUCCESS) {
+            // readDir() reports an empty container as an error. Check for this case.
+            vector<UPnPDirObject> entries;
+            int didread, total = -1;
+            server->readDirSlice(task.id, 0, 1, entries, &didread, &total, projp);
+            if (total != 0) {
+                recordError(task.id, ret);
+                return false;
+            }
+        }
+        node.updateid = task.updateid;
+        node.containers = std::move(dir.m_containers);
+        node.items = std::move(dir.m_items);
+        for (auto& obj : node.containers) {
+            obj.releaseDidl();
+            tasks.push_back(Task{obj.m_id, obj.getprop(updateidprop)});
+        }
+        for (auto& obj : node.items) {
+            obj.releaseDidl();
+        }
+        return true;
+    }
+
+    // Reuse the stored children for a container. The current update ids for the child
+    // containers come from the initial search.
+    void reuseNode(const Node& old, Node& node, vector<Task>& tasks) {
+        node = old;
+        for (const auto& obj : node.containers) {
+            auto it = curupdateids.find(obj.m_id);
+            // An empty update id forces reading the children.
+            tasks.push_back(Task{obj.m_id, it == curupdateids.end() ? string() : it->second});
+        }
+    }
+
+    // Get the current update ids for all the containers with a single search, if the server
+    // supports searching on upnp:class. Else, a container is only reused when we have the
+    // update ids for its children, so it is re-read: this is one paginated Browse, instead of
+    // one request per child container to get its metadata.
+    void fetchUpdateIds() {
+        curupdateids.clear();
+        hascurupdateids = false;
+        set<string> caps;
+        if (server->getSearchCapabilities(caps) != UPNP_E_SUCCESS ||
+            (caps.find("*") == caps.end() && caps.find("upnp:class") == caps.end())) {
+            return;
+        }
+        UPnPDirContent dir;
+        UPnPDirProjection idproj(updateidprop);
+        int ret = server->search("0", "upnp:class derivedfrom \"object.container\"", dir,
+                                 &idproj);
+        if (ret != UPNP_E_SUCCESS) {
+            LOGINF("CDCrawler: container search failed: " << ret << "\n");
+            return;
+        }
+        for (const auto& obj : dir.m_containers) {
+            curupdateids[obj.m_id] = obj.getprop(updateidprop);
+        }
+        hascurupdateids = true;
+    }
+
+    void processTask(const Task& task) {
+        Node node;
+        vector<Task> tasks;
+        bool ok = true;
+        bool reused = false;
+        auto it = nodes.find(task.id);
+        if (hascurupdateids && it != nodes.end() && !task.updateid.empty() &&
+            it->second.updateid == task.updateid) {
+            reuseNode(it->second, node, tasks);
+            reused = true;
+        } else {
+            ok = readNode(task, node, tasks);
+        }
+
+        std::unique_lock<std::mutex> lock(mtx);
+        if (ok) {
+            if (reused) {
+                stats.containersReused++;
+            } else {
+                stats.containersRead++;
+            }
+            newnodes[task.id] = std::move(node);
+            for (auto& t : tasks) {
+                pushTask(std::move(t));
+            }
+        }
+    }
+
+    void worker() {
+        std::unique_lock<std::mutex> lock(mtx);
+        for (;;) {
+            cond.wait(lock, [this] {return !queue.empty() || active == 0;});
+            if (queue.empty()) {
+                // Nothing queued and nobody working: done.
+                cond.notify_all();
+                return;
+            }
+            Task task = std::move(queue.front());
+            queue.pop_front();
+            active++;
+            lock.unlock();
+            processTask(task);
+            lock.lock();
+            active--;
+            if (active == 0 && queue.empty()) {
+                cond.notify_all();
+            }
+        }
+    }
+};
+
+CDCrawler::CDCrawler(CDSH server, int nthreads, const UPnPDirProjection *proj)
+    : m(new Internal())
+{
+    m->server = server;
+    m->nthreads = nthreads > 0 ? nthreads : 1;
+    if (proj && !proj->all()) {
+        string spec = proj->filter();
+        if (spec != "*") {
+            spec += "," + updateidprop;
+        }
+        m->proj = UPnPDirProjection(spec, proj->maxResources());
+        m->projp = &m->proj;
+    }
+}
+
+CDCrawler::~CDCrawler()
+{
+    delete m;
+}
+
+int CDCrawler::crawl()
+{
+    if (!m->server) {
+        return UPNP_E_INVALID_PARAM;
+    }
+    m->stats = Stats();
+
+    int sysupdateid;
+    bool hasupdateid = m->server->getSystemUpdateID(&sysupdateid) == UPNP_E_SUCCESS;
+    if (hasupdateid && m->hasupdateid && sysupdateid == m->sysupdateid) {
+        LOGDEB("CDCrawler: SystemUpdateID unchanged: " << sysupdateid << "\n");
+        m->stats.unchanged = true;
+        return UPNP_E_SUCCESS;
+    }
+
+    // The root update id comes from its metadata.
+    Internal::Task root{"0", string()};
+    UPnPDirContent meta;
+    if (m->server->getMetadata(root.id, meta, m->projp) == UPNP_E_SUCCESS &&
+        !meta.m_containers.empty()) {
+        root.updateid = meta.m_containers[0].getprop(updateidprop);
+    }
+
+    // Nothing can be reused on the first walk.
+    if (!m->nodes.empty()) {
+        m->fetchUpdateIds();
+    }
+
+    m->queue.clear();
+    m->seen.clear();
+    m->newnodes.clear();
+    m->active = 0;
+    m->firsterror = UPNP_E_SUCCESS;
+    m->pushTask(std::move(root));
+
+    vector<std::thread> workers;
+    for (int i = 0; i < m->nthreads; i++) {
+        workers.emplace_back(&Internal::worker, m);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    m->nodes.swap(m->newnodes);
+    m->newnodes.clear();
+    m->seen.clear();
+    m->curupdateids.clear();
+    m->hascurupdateids = false;
+    // Only trust the index for the next call if it is complete.
+    m->hasupdateid = hasupdateid && m->firsterror == UPNP_E_SUCCESS;
+    m->sysupdateid = sysupdateid;
+    LOGDEB("CDCrawler: read " << m->stats.containersRead << " reused " <<
+           m->stats.containersReused << " errors " << m->stats.errors << "\n");
+    return m->firsterror;
+}
+
+const CDCrawler::Stats& CDCrawler::stats() const
+{
+    return m->stats;
+}
+
+void CDCrawler::clear()
+{
+    m->nodes.clear();
+    m->hasupdateid = false;
+}
+
+size_t CDCrawler::containerCount() const
+{
+    size_t cnt = 0;
+    for (const auto& entry : m->nodes) {
+        cnt += entry.second.containers.size();
+    }
+    return cnt;
+}
+
+size_t CDCrawler::itemCount() const
+{
+    size_t cnt = 0;
+    for (const auto& entry : m->nodes) {
+        cnt += entry.second.items.size();
+    }
+    return cnt;
+}
+
+void CDCrawler::visit(const std::function<bool (const UPnPDirObject&)>& func) const
+{
+    for (const auto& entry : m->nodes) {
+        for (const auto& obj : entry.second.containers) {
+            if (!func(obj))
+                return;
+        }
+        for (const auto& obj : entry.second.items) {
+            if (!func(obj))
+                return;
+        }
+    }
+}
+
+bool CDCrawler::getChildren(const string& objectId, UPnPDirContent& dirbuf) const
+{
+    auto it = m->nodes.find(objectId);
+    if (it == m->nodes.end()) {
+        return false;
+    }
+    dirbuf.m_containers = it->second.containers;
+    dirbuf.m_items = it->second.items;
+    return true;
+}
+
+void CDCrawler::exportTo(UPnPDirCompactContent& out) const
+{
+    visit([&out](const UPnPDirObject& obj) {
+        out.add(obj);
+        return true;
+    });
+}
+
+} // namespace UPnPClient
@@ -0,0 +1,113 @@
+/* Copyright (C) 2024 J.F.Dockes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301 USA
+ */
+#ifndef _CDIRCRAWLER_HXX_INCLUDED_
+#define _CDIRCRAWLER_HXX_INCLUDED_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "libupnpp/control/cdircontent.hxx"
+#include "libupnpp/control/cdirectory.hxx"
+
+namespace UPnPClient {
+
+/**
+ * Walk the whole object tree of a Content Directory and keep a local index of its containers
+ * and items, e.g. for a local library view or local searches.
+ *
+ * The containers are read by a bounded number of worker threads. The index is kept after
+ * crawl() returns, and the next calls only re-read what changed:
+ *  - Nothing is read if the server SystemUpdateID did not change.
+ *  - Else the tree is walked again, but the children of a container are only re-read if its
+ *    upnp:containerUpdateID property changed (this is the per-container value reported by
+ *    the ContainerUpdateIDs events). The stored list is reused otherwise. The current values
+ *    for all the containers are obtained with a single search, so the stored lists can only
+ *    be reused if the server supports searching on upnp:class. Servers which do not set
+ *    upnp:containerUpdateID are fully re-read.
+ *
+ * The objects in the index do not keep a reference to the DIDL text (see
+ * UPnPDirObject::releaseDidl()): use ContentDirectory::getMetadata() if getdidl() is needed.
+ *
+ * The object is not thread-safe: the accessors must not be called while crawl() is running.
+ */
+class UPNPP_API CDCrawler {
+public:
+    /**
+     * @param server the Content Directory service.
+     * @param nthreads maximum number of containers read in parallel. Each readDir() may
+     *    itself issue concurrent requests, see ContentDirectory::setReadConcurrency().
+     * @param proj optional projection for the stored objects (copied).
+     *    upnp:containerUpdateID is always requested for containers.
+     */
+    CDCrawler(CDSH server, int nthreads = 4, const UPnPDirProjection *proj = nullptr);
+    ~CDCrawler();
+    CDCrawler(const CDCrawler&) = delete;
+    CDCrawler& operator=(const CDCrawler&) = delete;
+
+    /** Counters for the last crawl() call */
+    struct Stats {
+        // SystemUpdateID unchanged: nothing was read.
+        bool unchanged{false};
+        // Containers for which the children were read.
+        int containersRead{0};
+        // Containers for which the stored children were reused.
+        int containersReused{0};
+        // Containers which could not be read.
+        int errors{0};
+    };
+
+    /** Walk the tree from the root container, or update the index from a previous walk.
+     *
+     * Containers which can't be read are skipped (with their subtree), and the walk goes on.
+     * @return UPNP_E_SUCCESS, or the first error. In case of error, the next call will walk
+     *    the tree again even if the SystemUpdateID did not change.
+     */
+    int crawl();
+
+    /** Return the counters for the last crawl() */
+    const Stats& stats() const;
+
+    /** Forget the index. The next crawl() will read everything. */
+    void clear();
+
+    /** Number of containers in the index, not counting the root */
+    size_t containerCount() const;
+
+    /** Number of items in the index */
+    size_t itemCount() const;
+
+    /** Call @param func for each object in the index, containers and items, in no particular
+     * order. The walk stops if func returns false. */
+    void visit(const std::function<bool (const UPnPDirObject&)>& func) const;
+
+    /** Get the stored children of a container.
+     * @return false if the container is not in the index. */
+    bool getChildren(const std::string& objectId, UPnPDirContent& dirbuf) const;
+
+    /** Add all the objects in the index to a compact store */
+    void exportTo(UPnPDirCompactContent& out) const;
+
+private:
+    class UPNPP_LOCAL Internal;
+    Internal *m;
+};
+
+} // namespace UPnPClient
+
+#endif /* _CDIRCRAWLER_HXX_INCLUDED_ */
@@ -0,0 +1,250 @@
+/* Copyright (C) 2024 J.F.Dockes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301 USA
+ */
+#include "config.h"
+
+#include "libupnpp/control/cdircursor.hxx"
+
+#include <upnp.h>
+
+#include <algorithm>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "libupnpp/log.hxx"
+
+using namespace std;
+
+namespace UPnPClient {
+
+class CDCursor::Internal {
+public:
+    struct Page {
+        vector<UPnPDirObject> entries;
+        list<int>::iterator lruit;
+    };
+
+    CDSH server;
+    string objid;
+    string search;
+    string sort;
+    bool hasproj{false};
+    UPnPDirProjection proj;
+    int pagesize;
+    size_t maxpages;
+    // Total count, -1 if not known yet
+    int total{-1};
+    // Highest offset read + 1. This is a lower bound for the total while it is unknown.
+    int seen{0};
+    int lasterror{UPNP_E_SUCCESS};
+    unordered_map<int, Page> pages;
+    // Page numbers, most recently used first
+    list<int> lru;
+
+    // Read entries from the server, appending them to the vector.
+    int readSlice(int offset, int count, vector<UPnPDirObject>& entries, int *didread,
+                  int *ntotal) {
+        const UPnPDirProjection *pp = hasproj ? &proj : nullptr;
+        *ntotal = -1;
+        if (search.empty()) {
+            return server->readDirSlice(objid, offset, count, entries, didread, ntotal, pp,
+                                        sort);
+        } else {
+            return server->searchSlice(objid, search, offset, count, entries, didread,
+                                       ntotal, pp, sort);
+        }
+    }
+
+    // Update the total count from the result of a request for @param asked entries at
+    // @param offset. Some servers set TotalMatches to 0 if they don't know. In this case, the
+    // total is only known when a short slice shows the end of the list.
+    void setTotal(int offset, int asked, int didread, int ntotal) {
+        seen = std::max(seen, offset + didread);
+        if (ntotal > 0) {
+            total = std::max(ntotal, seen);
+        } else if (didread > 0 ? didread < asked : offset <= seen) {
+            total = seen;
+        }
+    }
+
+    // Get the total count with a minimal request.
+    int probe() {
+        vector<UPnPDirObject> entries;
+        int didread = 0;
+        int ntotal;
+        int ret = readSlice(0, 1, entries, &didread, &ntotal);
+        if (ret != UPNP_E_SUCCESS) {
+            // An empty container is reported as an error by readDirSlice(), but the total is
+            // set in this case.
+            if (ntotal == 0) {
+                total = 0;
+                return UPNP_E_SUCCESS;
+            }
+            lasterror = ret;
+            return ret;
+        }
+        setTotal(0, 1, didread, ntotal);
+        return UPNP_E_SUCCESS;
+    }
+
+    Page *getPage(int pagenum) {
+        auto it = pages.find(pagenum);
+        if (it != pages.end()) {
+            lru.splice(lru.begin(), lru, it->second.lruit);
+            return &it->second;
+        }
+
+        Page page;
+        int offset = pagenum * pagesize;
+        int end = offset + pagesize;
+        if (total >= 0) {
+            end = std::min(end, total);
+        }
+        // Loop in case the server returns less than we asked for.
+        while (offset < end) {
+            int didread = 0;
+            int ntotal;
+            int asked = end - offset;
+            int ret = readSlice(offset, asked, page.entries, &didread, &ntotal);
+            if (ret != UPNP_E_SUCCESS) {
+                if (ntotal == 0 && offset == 0) {
+                    total = 0;
+                    break;
+                }
+                LOGINF("CDCursor: read failed for " << objid << " offset " << offset <<
+                       " error " << ret << "\n");
+                lasterror = ret;
+                return nullptr;
+            }
+            setTotal(offset, asked, didread, ntotal);
+            if (didread <= 0) {
+                break;
+            }
+            offset += didread;
+            if (total >= 0) {
+                end = std::min(end, total);
+            }
+        }
+
+        while (pages.size() >= maxpages && !lru.empty()) {
+            pages.erase(lru.back());
+            lru.pop_back();
+        }
+        lru.push_front(pagenum);
+        page.lruit = lru.begin();
+        return &(pages[pagenum] = std::move(page));
+    }
+};
+
+CDCursor::CDCursor(CDSH server, const string& objectId, const string& searchstring,
+                   const UPnPDirProjection *proj, int pagesize, int maxpages,
+                   const string& sortcrit)
+    : m(new Internal())
+{
+    m->server = server;
+    m->objid = objectId;
+    m->search = searchstring;
+    m->sort = sortcrit;
+    if (proj) {
+        m->hasproj = true;
+        m->proj = *proj;
+    }
+    m->pagesize = pagesize > 0 ? pagesize : (server ? server->goodSliceSize() : 100);
+    m->maxpages = maxpages > 0 ? maxpages : 1;
+}
+
+CDCursor::~CDCursor()
+{
+    delete m;
+}
+
+int CDCursor::size()
+{
+    if (m->total < 0 && (!m->server || m->probe() != UPNP_E_SUCCESS)) {
+        return -1;
+    }
+    // If the server does not report the total, read on until the end of the list.
+    while (m->total < 0) {
+        if (nullptr == m->getPage(m->seen / m->pagesize)) {
+            return -1;
+        }
+    }
+    return m->total;
+}
+
+const UPnPDirObject *CDCursor::get(int idx)
+{
+    if (!m->server || idx < 0 || (m->total >= 0 && idx >= m->total)) {
+        return nullptr;
+    }
+    Internal::Page *page = m->getPage(idx / m->pagesize);
+    if (nullptr == page) {
+        return nullptr;
+    }
+    size_t pos = idx % m->pagesize;
+    if (pos >= page->entries.size()) {
+        return nullptr;
+    }
+    return &page->entries[pos];
+}
+
+bool CDCursor::get(int idx, UPnPDirObject& obj)
+{
+    const UPnPDirObject *objp = get(idx);
+    if (nullptr == objp) {
+        return false;
+    }
+    obj = *objp;
+    return true;
+}
+
+int CDCursor::load(int start, int count)
+{
+    if (!m->server) {
+        return UPNP_E_INVALID_PARAM;
+    }
+    start = std::max(start, 0);
+    int end = start + count;
+    if (m->total >= 0) {
+        end = std::min(end, m->total);
+    }
+    for (int pagenum = start / m->pagesize; pagenum * m->pagesize < end &&
+             (m->total < 0 || pagenum * m->pagesize < m->total); pagenum++) {
+        if (nullptr == m->getPage(pagenum)) {
+            return m->lasterror;
+        }
+    }
+    return UPNP_E_SUCCESS;
+}
+
+void CDCursor::reset()
+{
+    m->pages.clear();
+    m->lru.clear();
+    m->total = -1;
+    m->seen = 0;
+}
+
+int CDCursor::lastError() const
+{
+    return m->lasterror;
+}
+
+} // namespace UPnPClient
@@ -0,0 +1,91 @@
+/* Copyright (C) 2024 J.F.Dockes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301 USA
+ */
+#ifndef _CDIRCURSOR_HXX_INCLUDED_
+#define _CDIRCURSOR_HXX_INCLUDED_
+
+#include <string>
+
+#include "libupnpp/control/cdircontent.hxx"
+#include "libupnpp/control/cdirectory.hxx"
+
+namespace UPnPClient {
+
+/**
+ * Random access cursor over the children of a container, or over the results of a search.
+ *
+ * The entries are fetched by pages when they are accessed, and a limited number of pages are
+ * kept in memory (least recently used are dropped first). The total count is obtained with a
+ * single-entry request if it is needed before any page was fetched. This is typically used
+ * behind a virtual list view which only displays a small window of a big container.
+ *
+ * The entries are in the server order, containers and items mixed. The object is not
+ * thread-safe.
+ */
+class UPNPP_API CDCursor {
+public:
+    /**
+     * @param server the Content Directory service.
+     * @param objectId the container. For a search, the object under which to search.
+     * @param searchstring if not empty, the cursor is over the results of this search, else
+     *    over the container children.
+     * @param proj optional projection for the entries (copied).
+     * @param pagesize number of entries per page. 0 for the server slice size.
+     * @param maxpages maximum number of pages kept in memory.
+     * @param sortcrit optional sort criteria, see ContentDirectory::readDir().
+     */
+    CDCursor(CDSH server, const std::string& objectId,
+             const std::string& searchstring = std::string(),
+             const UPnPDirProjection *proj = nullptr, int pagesize = 0, int maxpages = 16,
+             const std::string& sortcrit = std::string());
+    ~CDCursor();
+    CDCursor(const CDCursor&) = delete;
+    CDCursor& operator=(const CDCursor&) = delete;
+
+    /** Return the number of entries (TotalMatches), or -1 in case of error. If the server
+     * does not report the total, the entries are read up to the end of the list to count
+     * them. */
+    int size();
+
+    /** Get the entry at index @param idx, fetching its page if needed.
+     * @return a pointer to the entry, valid until the next call to a method which may fetch a
+     *    page, or nullptr for an error or out of range index.
+     */
+    const UPnPDirObject *get(int idx);
+
+    /** Same as above, but copy the entry. @return false for error or out of range. */
+    bool get(int idx, UPnPDirObject& obj);
+
+    /** Make sure that the entries in [start, start+count) are in memory, e.g. for the visible
+     * window of a list. The window should be smaller than the page cache.
+     * @return UPNP_E_SUCCESS or an error code. */
+    int load(int start, int count);
+
+    /** Forget the pages and count, e.g. after a container update event */
+    void reset();
+
+    /** Return the error code for the last failed request */
+    int lastError() const;
+
+private:
+    class UPNPP_LOCAL Internal;
+    Internal *m;
+};
+
+} // namespace UPnPClient
+
+#endif /* _CDIRCURSOR_HXX_INCLUDED_ */
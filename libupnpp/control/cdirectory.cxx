@@ -24,10 +24,21 @@
 #include <upnp.h>
 #include <upnptools.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <set>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "libupnpp/control/cdircontent.hxx"
@@ -37,6 +48,7 @@
 #include "libupnpp/smallut.h"
 #include "libupnpp/soaphelp.hxx"
 #include "libupnpp/upnpp_p.hxx"
+#include "libupnpp/workqueue.h"
 
 using namespace std;
 using namespace std::placeholders;
@@ -59,15 +71,26 @@ bool ContentDirectory::serviceTypeMatch(const std::string& tp)
     return isCDService(tp);
 }
 
+static void cacheEvent(const string& udn, const std::unordered_map<string, string>& props);
+
 void ContentDirectory::evtCallback(const std::unordered_map<string, string>& props)
 {
+    if (m_cacheon) {
+        cacheEvent(getDeviceId(), props);
+    }
+    if (props.find("ContainerUpdateIDs") != props.end() ||
+        props.find("SystemUpdateID") != props.end()) {
+        std::unique_lock<std::mutex> lock(m_sortedmutex);
+        m_sortedkey.clear();
+        m_sorted.reset();
+    }
     for (const auto& [propname, propvalue] : props) {
         if (!getReporter()) {
             LOGDEB1("ContentDirectory::evtCallback: " << propname << " -> " << propvalue<<"\n");
             continue;
         }
         if (propname == "SystemUpdateID") {
-            getReporter()->changed(propname.c_str(), atoi(propvalue.c_str()));
+            getReporter()->changed(propname.c_str(), stringToInt(propvalue));
         } else if (propname == "ContainerUpdateIDs" || propname == "TransferIDs") {
             getReporter()->changed(propname.c_str(), propvalue.c_str());
         } else {
@@ -92,6 +115,113 @@ static const SimpleRegexp minidlna_rx("minidlna", sreflags);
 static const SimpleRegexp minim_rx("minim", sreflags);
 static const SimpleRegexp twonky_rx("twonky", sreflags);
 
+// Slice size tuning.
+//
+// We aim for requests which take about a second: large enough that the fixed per-request cost
+// is amortized, small enough that the first results come quickly. The size is estimated from
+// the per-entry duration of the last full Browse slice, changing by at most a factor of 2 each
+// time. Search slices are not sampled, as their duration depends on the query, but they use
+// the same size. We also keep the response size well under the max content length set at
+// init, and never ask more than the server is willing to return. The learned values are shared
+// by the servers with the same manufacturer and model.
+struct SliceSizeEntry {
+    int size;
+    // NumberReturned limit observed for this server model, or 0.
+    int cap{0};
+};
+static std::mutex o_slicemutex;
+static std::map<string, SliceSizeEntry> o_slicesizes;
+static const int slice_target_ms = 1000;
+static const int slice_min = 50;
+static const int slice_max = 5000;
+static const size_t slice_max_bytes = 1500 * 1024;
+
+string ContentDirectory::sliceKey()
+{
+    return getManufacturer() + "/" + getModelName();
+}
+
+void ContentDirectory::sliceSample(int requested, int returned, bool more, size_t bytes, int ms)
+{
+    string key = sliceKey();
+    std::unique_lock<std::mutex> lock(o_slicemutex);
+    auto it = o_slicesizes.find(key);
+    if (it == o_slicesizes.end()) {
+        it = o_slicesizes.insert({key, SliceSizeEntry{m_rdreqcnt}}).first;
+    }
+    SliceSizeEntry& entry = it->second;
+    int size = entry.size;
+    if (returned < requested && more) {
+        // The server limits the count returned. No use asking for more.
+        if (entry.cap == 0 || returned < entry.cap) {
+            LOGDEB("ContentDirectory: " << key << " returns at most " << returned <<
+                   " entries\n");
+            entry.cap = returned;
+        }
+        size = std::min(size, returned);
+    } else if (returned == requested && requested == size) {
+        // Full-size slice: use it to estimate the best size.
+        double msperentry = std::max(ms, 1) / double(returned);
+        double bytesperentry = std::max(bytes, size_t(1)) / double(returned);
+        double ideal = std::min(slice_target_ms / msperentry, slice_max_bytes / bytesperentry);
+        size = std::clamp(int(std::min(ideal, double(slice_max))), size / 2, size * 2);
+    }
+    size = std::clamp(size, slice_min, slice_max);
+    if (entry.cap) {
+        size = std::min(size, entry.cap);
+    }
+    if (size != entry.size) {
+        LOGDEB("ContentDirectory: slice size for " << key << " now " << size << " (" <<
+               returned << " entries, " << bytes << " bytes in " << ms << " mS)\n");
+        entry.size = size;
+    }
+    m_rdreqcnt = size;
+}
+
+bool ContentDirectory::saveSliceSizes(const string& path)
+{
+    std::ofstream out(path, std::ios::out | std::ios::trunc);
+    if (!out.is_open()) {
+        LOGERR("ContentDirectory::saveSliceSizes: can't open " << path << "\n");
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(o_slicemutex);
+    for (const auto& [key, entry] : o_slicesizes) {
+        out << entry.size << " " << entry.cap << " " << key << "\n";
+    }
+    out.close();
+    if (out.fail()) {
+        LOGERR("ContentDirectory::saveSliceSizes: write failed for " << path << "\n");
+        return false;
+    }
+    return true;
+}
+
+bool ContentDirectory::loadSliceSizes(const string& path)
+{
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        LOGDEB("ContentDirectory::loadSliceSizes: can't open " << path << "\n");
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(o_slicemutex);
+    string line;
+    while (std::getline(in, line)) {
+        std::istringstream str(line);
+        SliceSizeEntry entry;
+        string key;
+        if (!(str >> entry.size >> entry.cap) || !std::getline(str, key)) {
+            continue;
+        }
+        trimstring(key);
+        if (key.empty() || entry.size < slice_min || entry.size > slice_max) {
+            continue;
+        }
+        o_slicesizes[key] = entry;
+    }
+    return true;
+}
+
 ContentDirectory::ContentDirectory(const UPnPDeviceDesc& device,
                                    const UPnPServiceDesc& service)
     : Service(device, service)
@@ -101,6 +231,12 @@ ContentDirectory::ContentDirectory(const UPnPDeviceDesc& device,
     serviceInit(device, service);
 }
 
+ContentDirectory::~ContentDirectory()
+{
+    setPrefetch(0);
+    setCacheEnabled(false);
+}
+
 bool ContentDirectory::serviceInit(const UPnPDeviceDesc&,
                                    const UPnPServiceDesc&)
 {
@@ -123,6 +259,13 @@ bool ContentDirectory::serviceInit(const UPnPDeviceDesc&,
         m_serviceKind = CDSKIND_TWONKY;
         LOGDEB1("ContentDirectory::ContentDirectory: TWONKY\n");
     }
+    string key = sliceKey();
+    std::unique_lock<std::mutex> lock(o_slicemutex);
+    auto it = o_slicesizes.find(key);
+    if (it != o_slicesizes.end()) {
+        m_rdreqcnt = it->second.size;
+        LOGDEB1("ContentDirectory::ContentDirectory: learned slice size " << m_rdreqcnt << "\n");
+    }
     return true;
 }
 
@@ -166,26 +309,695 @@ void ContentDirectory::registerCallback()
     Service::registerCallback(bind(&ContentDirectory::evtCallback, this, _1));
 }
 
+static const string allfilter("*");
+
+const string& ContentDirectory::requestFilter(const UPnPDirProjection *proj)
+{
+    if (nullptr == proj || !m_filterok) {
+        return allfilter;
+    }
+    return proj->filter();
+}
+
+// Check if a failed request should be retried without the filter: only for the errors which
+// say that the arguments were rejected (402 Invalid args, 720 Cannot process the request), not
+// e.g. for 701 No such object. The filter is disabled for the retry, and filterRetried() decides
+// if this is permanent.
+bool ContentDirectory::filterFailed(int ret, const string& filter)
+{
+    if ((ret != 402 && ret != 720) || filter == allfilter) {
+        return false;
+    }
+    LOGDEB("CDService: request with Filter [" << filter << "] failed with error " << ret <<
+           ", retrying without filter for " << getFriendlyName() << "\n");
+    m_filterok = false;
+    return true;
+}
+
+// Called with the result of the retry after filterFailed(). If the request still failed, the
+// filter was not the problem and we go on using it.
+int ContentDirectory::filterRetried(int ret)
+{
+    if (ret == UPNP_E_SUCCESS) {
+        LOGINF("CDService: not using filters any more for " << getFriendlyName() << "\n");
+    } else {
+        m_filterok = true;
+    }
+    return ret;
+}
+
+// Parse a SortCriteria string into (property, ascending) pairs
+static vector<pair<string, bool>> parseSortCriteria(const string& sortcrit)
+{
+    vector<pair<string, bool>> fields;
+    vector<string> tokens;
+    stringToTokens(sortcrit, tokens, ",");
+    for (auto& token : tokens) {
+        trimstring(token);
+        bool ascending = true;
+        if (!token.empty() && (token[0] == '+' || token[0] == '-')) {
+            ascending = token[0] == '+';
+            token.erase(0, 1);
+        }
+        if (!token.empty()) {
+            fields.emplace_back(token, ascending);
+        }
+    }
+    return fields;
+}
+
+// Check if the server can sort on all the fields from a criteria string. The capabilities are
+// only asked once.
+bool ContentDirectory::canSort(const string& sortcrit)
+{
+    if (!m_sortok) {
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(m_sortmutex);
+    if (!m_sortcapsknown) {
+        if (getSortCapabilities(m_sortcaps) != UPNP_E_SUCCESS) {
+            m_sortcaps.clear();
+        }
+        m_sortcapsknown = true;
+    }
+    if (m_sortcaps.empty()) {
+        return false;
+    }
+    if (m_sortcaps.find("*") != m_sortcaps.end()) {
+        return true;
+    }
+    for (const auto& field : parseSortCriteria(sortcrit)) {
+        if (m_sortcaps.find(field.first) == m_sortcaps.end()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Same as filterFailed() for the sort criteria: after the server rejected the sort criteria
+// (709 Unsupported or invalid sort criteria, or 402 Invalid args), we sort locally. Other errors
+// (e.g. 701 No such object) are returned as is.
+bool ContentDirectory::sortFailed(int ret, const string& sortcrit)
+{
+    if ((ret != 709 && ret != 402) || sortcrit.empty()) {
+        return false;
+    }
+    LOGINF("CDService: request with SortCriteria [" << sortcrit << "] failed with error " <<
+           ret << ", sorting locally from now on for " << getFriendlyName() << "\n");
+    m_sortok = false;
+    return true;
+}
+
+// Local sort key for one property value
+struct SortKey {
+    string value;
+    bool isnum{false};
+    int64_t num{0};
+};
+
+static int compareSortKeys(const SortKey& k1, const SortKey& k2)
+{
+    if (k1.isnum && k2.isnum) {
+        return k1.num < k2.num ? -1 : (k1.num > k2.num ? 1 : 0);
+    }
+    return k1.value.compare(k2.value);
+}
+
+static const string& sortValue(const UPnPDirObject& obj, const string& name)
+{
+    static const string empty;
+    if (name == "dc:title") {
+        return obj.m_title;
+    } else if (name == "@id") {
+        return obj.m_id;
+    } else if (name == "@parentID") {
+        return obj.m_pid;
+    } else if (name.compare(0, 4, "res@") == 0) {
+        if (obj.m_resources.empty()) {
+            return empty;
+        }
+        auto it = obj.m_resources[0].m_props.find(name.substr(4));
+        return it == obj.m_resources[0].m_props.end() ? empty : it->second;
+    }
+    return obj.getprop(name);
+}
+
+void ContentDirectory::sortEntries(vector<UPnPDirObject>& entries, const string& sortcrit)
+{
+    auto fields = parseSortCriteria(sortcrit);
+    if (fields.empty() || entries.size() < 2) {
+        return;
+    }
+    // Compute the keys once, then sort the indexes.
+    size_t nfields = fields.size();
+    vector<SortKey> keys(entries.size() * nfields);
+    for (size_t i = 0; i < entries.size(); i++) {
+        for (size_t j = 0; j < nfields; j++) {
+            SortKey& key = keys[i * nfields + j];
+            key.value = stringtolower(sortValue(entries[i], fields[j].first));
+            char *endp;
+            long long num = strtoll(key.value.c_str(), &endp, 10);
+            if (!key.value.empty() && *endp == 0) {
+                key.isnum = true;
+                key.num = num;
+            }
+        }
+    }
+    vector<size_t> order(entries.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&] (size_t i1, size_t i2) {
+        for (size_t j = 0; j < nfields; j++) {
+            int cmp = compareSortKeys(keys[i1 * nfields + j], keys[i2 * nfields + j]);
+            if (cmp != 0) {
+                return fields[j].second ? cmp < 0 : cmp > 0;
+            }
+        }
+        return false;
+    });
+    vector<UPnPDirObject> sorted;
+    sorted.reserve(entries.size());
+    for (auto idx : order) {
+        sorted.push_back(std::move(entries[idx]));
+    }
+    entries.swap(sorted);
+}
+
+// Browse result cache, see setCacheEnabled(). The cache for a server is created when the first
+// ContentDirectory object enables it, and deleted when the last one disables it.
+struct BrowseCacheEntry {
+    UPnPDirContent content;
+    int didread{0};
+    int total{0};
+    // Size of the DIDL text referenced by the objects. Computed by cachePut().
+    size_t nbytes{0};
+    size_t size() const {
+        return content.m_containers.size() + content.m_items.size() + 1;
+    }
+    size_t didlSize() const {
+        size_t bytes = 0;
+        for (const auto& obj : content.m_containers) {
+            bytes += obj.didlSize();
+        }
+        for (const auto& obj : content.m_items) {
+            bytes += obj.didlSize();
+        }
+        return bytes;
+    }
+};
+// The objects keep a reference to the DIDL text for getdidl(), which is usually bigger than
+// the parsed data. Limit it to this average per object, as given to setCacheEnabled().
+static const size_t cache_didl_bytes_per_object = 2048;
+typedef std::unordered_map<string, std::shared_ptr<BrowseCacheEntry>> BrowseCacheBucket;
+struct BrowseCache {
+    int users{0};
+    size_t maxobjects{0};
+    size_t nobjects{0};
+    size_t maxbytes{0};
+    size_t nbytes{0};
+    size_t nentries{0};
+    // Incremented by each invalidation. A result is only stored if no invalidation happened
+    // while the request was running.
+    uint64_t generation{0};
+    string sysupdateid;
+    // Entries by the id of the container the updates of which invalidate them, then by request
+    // key. Metadata entries are stored for both the object and its parent.
+    std::unordered_map<string, BrowseCacheBucket> buckets;
+    // Insertion order (bucket, key), for eviction. May refer to already removed entries.
+    std::deque<std::pair<string, string>> order;
+
+    void eraseBucket(const string& id) {
+        auto it = buckets.find(id);
+        if (it == buckets.end()) {
+            return;
+        }
+        for (const auto& [key, entry] : it->second) {
+            nobjects -= entry->size();
+            nbytes -= entry->nbytes;
+            nentries--;
+        }
+        buckets.erase(it);
+    }
+    void eraseEntry(const string& id, const string& key) {
+        auto it = buckets.find(id);
+        if (it == buckets.end()) {
+            return;
+        }
+        auto eit = it->second.find(key);
+        if (eit == it->second.end()) {
+            return;
+        }
+        nobjects -= eit->second->size();
+        nbytes -= eit->second->nbytes;
+        nentries--;
+        it->second.erase(eit);
+        if (it->second.empty()) {
+            buckets.erase(it);
+        }
+    }
+    void clear() {
+        buckets.clear();
+        order.clear();
+        nobjects = nbytes = nentries = 0;
+        generation++;
+    }
+};
+static std::mutex o_cachemutex;
+static std::unordered_map<string, BrowseCache> o_caches;
+
+static string cacheKey(const char *flag, const string& objid, const UPnPDirProjection *proj,
+                       const string& sort, int offset = 0, int count = 0)
+{
+    string key(flag);
+    key.append(1, '\n').append(objid).append(1, '\n');
+    if (proj) {
+        key.append(proj->filter()).append(1, '\n').append(lltodecstr(proj->maxResources()));
+    } else {
+        key.append(allfilter);
+    }
+    key.append(1, '\n').append(sort).append(1, '\n').append(lltodecstr(offset)).append(1, '\n')
+        .append(lltodecstr(count));
+    return key;
+}
+
+static void appendDir(UPnPDirContent& dest, const UPnPDirContent& src)
+{
+    dest.m_containers.insert(dest.m_containers.end(), src.m_containers.begin(),
+                             src.m_containers.end());
+    dest.m_items.insert(dest.m_items.end(), src.m_items.begin(), src.m_items.end());
+}
+
+static void appendDir(UPnPDirContent& dest, UPnPDirContent&& src)
+{
+    std::move(src.m_containers.begin(), src.m_containers.end(),
+              std::back_inserter(dest.m_containers));
+    std::move(src.m_items.begin(), src.m_items.end(), std::back_inserter(dest.m_items));
+}
+
+// Get the current generation for a server cache. Returns false if the cache is not enabled.
+static bool cacheGeneration(const string& udn, uint64_t *gen)
+{
+    std::unique_lock<std::mutex> lock(o_cachemutex);
+    auto it = o_caches.find(udn);
+    if (it == o_caches.end()) {
+        return false;
+    }
+    *gen = it->second.generation;
+    return true;
+}
+
+// Look up a request result, and append it to dirbuf if found.
+static bool cacheGet(const string& udn, const string& id, const string& key,
+                     UPnPDirContent& dirbuf, int *didread = nullptr, int *total = nullptr)
+{
+    std::shared_ptr<BrowseCacheEntry> entry;
+    {
+        std::unique_lock<std::mutex> lock(o_cachemutex);
+        auto it = o_caches.find(udn);
+        if (it == o_caches.end()) {
+            return false;
+        }
+        auto bit = it->second.buckets.find(id);
+        if (bit == it->second.buckets.end()) {
+            return false;
+        }
+        auto eit = bit->second.find(key);
+        if (eit == bit->second.end()) {
+            return false;
+        }
+        entry = eit->second;
+    }
+    LOGDEB1("ContentDirectory: cache hit for " << id << "\n");
+    appendDir(dirbuf, entry->content);
+    if (didread) {
+        *didread = entry->didread;
+    }
+    if (total) {
+        *total = entry->total;
+    }
+    return true;
+}
+
+// Store a request result, if the cache was not invalidated since we got the generation value.
+static void cachePut(const string& udn, uint64_t gen, const vector<string>& ids,
+                     const string& key, std::shared_ptr<BrowseCacheEntry> entry)
+{
+    std::unique_lock<std::mutex> lock(o_cachemutex);
+    auto it = o_caches.find(udn);
+    if (it == o_caches.end() || it->second.generation != gen) {
+        return;
+    }
+    BrowseCache& cache = it->second;
+    size_t size = entry->size();
+    entry->nbytes = entry->didlSize();
+    if (size > cache.maxobjects || entry->nbytes > cache.maxbytes) {
+        return;
+    }
+    for (const auto& id : ids) {
+        cache.eraseEntry(id, key);
+        cache.buckets[id][key] = entry;
+        cache.nobjects += size;
+        cache.nbytes += entry->nbytes;
+        cache.nentries++;
+        cache.order.emplace_back(id, key);
+    }
+    while ((cache.nobjects > cache.maxobjects || cache.nbytes > cache.maxbytes) &&
+           !cache.order.empty()) {
+        cache.eraseEntry(cache.order.front().first, cache.order.front().second);
+        cache.order.pop_front();
+    }
+    // Get rid of the references to invalidated entries from time to time.
+    if (cache.order.size() > 2 * cache.nentries + 100) {
+        std::deque<std::pair<string, string>> order;
+        for (auto& ref : cache.order) {
+            auto bit = cache.buckets.find(ref.first);
+            if (bit != cache.buckets.end() && bit->second.find(ref.second) != bit->second.end()) {
+                order.push_back(std::move(ref));
+            }
+        }
+        cache.order.swap(order);
+    }
+}
+
+// Invalidate cache entries from an event. Precisely if the event has ContainerUpdateIDs, else
+// globally if the SystemUpdateID changed.
+static void cacheEvent(const string& udn, const std::unordered_map<string, string>& props)
+{
+    std::unique_lock<std::mutex> lock(o_cachemutex);
+    auto it = o_caches.find(udn);
+    if (it == o_caches.end()) {
+        return;
+    }
+    BrowseCache& cache = it->second;
+    auto cuit = props.find("ContainerUpdateIDs");
+    auto suit = props.find("SystemUpdateID");
+    if (cuit != props.end() && !cuit->second.empty()) {
+        // id1,updateid1,id2,updateid2...
+        vector<string> tokens;
+        csvToStrings(cuit->second, tokens);
+        for (unsigned int i = 0; i + 1 < tokens.size(); i += 2) {
+            LOGDEB1("ContentDirectory: cache: invalidating container " << tokens[i] << "\n");
+            cache.eraseBucket(tokens[i]);
+        }
+        // Also reject the results of the requests which are running: they may be for one of
+        // these containers, even if we had nothing stored for it yet.
+        cache.generation++;
+    } else if (suit != props.end() && suit->second != cache.sysupdateid) {
+        LOGDEB1("ContentDirectory: cache: SystemUpdateID changed, invalidating all\n");
+        cache.clear();
+    }
+    if (suit != props.end()) {
+        cache.sysupdateid = suit->second;
+    }
+}
+
+static bool cacheHas(const string& udn, const string& id, const string& key)
+{
+    std::unique_lock<std::mutex> lock(o_cachemutex);
+    auto it = o_caches.find(udn);
+    if (it == o_caches.end()) {
+        return false;
+    }
+    auto bit = it->second.buckets.find(id);
+    return bit != it->second.buckets.end() && bit->second.find(key) != bit->second.end();
+}
+
+static void cacheClear(const string& udn)
+{
+    std::unique_lock<std::mutex> lock(o_cachemutex);
+    auto it = o_caches.find(udn);
+    if (it != o_caches.end()) {
+        it->second.clear();
+    }
+}
+
+bool ContentDirectory::setCacheEnabled(bool onoff, size_t maxobjects)
+{
+    if (onoff && !m_cacheon && !ok()) {
+        // We need the events
+        registerCallback();
+        if (!ok()) {
+            LOGERR("ContentDirectory::setCacheEnabled: event subscription failed\n");
+            return false;
+        }
+    }
+    {
+        std::unique_lock<std::mutex> lock(o_cachemutex);
+        if (onoff) {
+            auto& cache = o_caches[getDeviceId()];
+            if (!m_cacheon) {
+                cache.users++;
+            }
+            cache.maxobjects = maxobjects;
+            cache.maxbytes = maxobjects * cache_didl_bytes_per_object;
+        } else if (m_cacheon) {
+            auto it = o_caches.find(getDeviceId());
+            if (it != o_caches.end() && --it->second.users <= 0) {
+                o_caches.erase(it);
+            }
+        }
+    }
+    if (!onoff && m_cacheon && nullptr == getReporter()) {
+        unregisterCallback();
+    }
+    m_cacheon = onoff;
+    return true;
+}
+
+void ContentDirectory::installReporter(VarEventReporter* reporter)
+{
+    if (!m_cacheon) {
+        Service::installReporter(reporter);
+        return;
+    }
+    // The cache needs the subscription in any case, but the base class method unsubscribes or
+    // subscribes again. We may miss events in between, so reset the cache.
+    if (reporter) {
+        unregisterCallback();
+        Service::installReporter(reporter);
+    } else {
+        Service::installReporter(nullptr);
+        registerCallback();
+    }
+    cacheClear(getDeviceId());
+}
+
+// Background prefetching of child containers, see setPrefetch().
+struct PrefetchTask {
+    string objid;
+    bool hasproj{false};
+    UPnPDirProjection proj;
+};
+
+static void freePrefetchTask(PrefetchTask*& task)
+{
+    delete task;
+    task = nullptr;
+}
+
+class ContentDirectory::Prefetcher {
+public:
+    Prefetcher(ContentDirectory *cd, int count)
+        : m_cd(cd), m_count(count) {
+        m_queue.setTaskFreeFunc(freePrefetchTask);
+        m_queue.start(1, &Prefetcher::worker, this);
+    }
+    ~Prefetcher() {
+        // Get rid of the pending tasks, then stop the worker.
+        m_queue.put(nullptr, true);
+        m_queue.setTerminateAndWait();
+    }
+    Prefetcher(const Prefetcher&) = delete;
+    Prefetcher& operator=(const Prefetcher&) = delete;
+
+    static void *worker(void *arg) {
+        auto me = static_cast<Prefetcher*>(arg);
+        for (;;) {
+            PrefetchTask *task{nullptr};
+            if (!me->m_queue.take(&task)) {
+                me->m_queue.workerExit();
+                return (void*)1;
+            }
+            if (nullptr == task) {
+                continue;
+            }
+            // Let the foreground requests go first.
+            {
+                std::unique_lock<std::mutex> lock(me->m_fgmutex);
+                me->m_fgcond.wait(lock, [me] {return me->m_foreground == 0;});
+            }
+            me->prefetch(*task);
+            delete task;
+        }
+    }
+
+    void prefetch(const PrefetchTask& task) {
+        const UPnPDirProjection *proj = task.hasproj ? &task.proj : nullptr;
+        const string& udn = m_cd->getDeviceId();
+        uint64_t gen;
+        if (!m_cd->m_cacheon || !cacheGeneration(udn, &gen)) {
+            return;
+        }
+        string dkey = cacheKey("D", task.objid, proj, "");
+        string pkey = cacheKey("P", task.objid, proj, "");
+        if (cacheHas(udn, task.objid, dkey) || cacheHas(udn, task.objid, pkey)) {
+            return;
+        }
+        auto entry = std::make_shared<BrowseCacheEntry>();
+        if (m_cd->browseSlice(task.objid, 0, m_cd->m_rdreqcnt, entry->content, &entry->didread,
+                              &entry->total, proj) != UPNP_E_SUCCESS) {
+            return;
+        }
+        LOGDEB1("ContentDirectory: prefetched " << entry->didread << " of " << entry->total <<
+                " entries for " << task.objid << "\n");
+        // If we got everything, this is a complete readDir() result.
+        cachePut(udn, gen, {task.objid}, entry->didread >= entry->total ? dkey : pkey, entry);
+    }
+
+    ContentDirectory *m_cd;
+    int m_count;
+    // Called around the readDir() requests, which the prefetches wait for.
+    void foregroundStart() {
+        std::unique_lock<std::mutex> lock(m_fgmutex);
+        m_foreground++;
+    }
+    void foregroundEnd() {
+        std::unique_lock<std::mutex> lock(m_fgmutex);
+        if (--m_foreground == 0) {
+            m_fgcond.notify_all();
+        }
+    }
+
+    // Number of readDir() calls running.
+    int m_foreground{0};
+    std::mutex m_fgmutex;
+    std::condition_variable m_fgcond;
+    WorkQueue<PrefetchTask*> m_queue{"CDPrefetch"};
+};
+
+void ContentDirectory::setPrefetch(int ncontainers)
+{
+    delete m_prefetcher;
+    m_prefetcher = nullptr;
+    if (ncontainers > 0) {
+        m_prefetcher = new Prefetcher(this, ncontainers);
+    }
+}
+
+void ContentDirectory::prefetchChildren(const UPnPDirContent& dirbuf, size_t first,
+                                        const UPnPDirProjection *proj)
+{
+    // The first put() flushes the tasks remaining from the previous listing.
+    bool flush = true;
+    for (size_t i = first; i < dirbuf.m_containers.size() &&
+             i - first < size_t(m_prefetcher->m_count); i++) {
+        auto task = new PrefetchTask;
+        task->objid = dirbuf.m_containers[i].m_id;
+        if (proj) {
+            task->hasproj = true;
+            task->proj = *proj;
+        }
+        if (!m_prefetcher->m_queue.put(task, flush)) {
+            delete task;
+            break;
+        }
+        flush = false;
+    }
+}
+
 int ContentDirectory::readDirSlice(
-    const string& objectId, int offset, int count,
-    UPnPDirContent& dirbuf, int *didread, int *total)
+    const string& objectId, int offset, int count, UPnPDirContent& dirbuf, int *didread,
+    int *total, const UPnPDirProjection *proj, const string& sortcrit)
+{
+    if (!sortcrit.empty() && !canSort(sortcrit)) {
+        return sortedSlice(objectId, nullptr, offset, count, &dirbuf, nullptr, didread, total,
+                           proj, sortcrit);
+    }
+    uint64_t gen;
+    int ret;
+    if (!m_cacheon || !cacheGeneration(getDeviceId(), &gen)) {
+        ret = browseSlice(objectId, offset, count, dirbuf, didread, total, proj, nullptr,
+                          sortcrit);
+    } else {
+        string key = cacheKey("S", objectId, proj, sortcrit, offset, count);
+        if (cacheGet(getDeviceId(), objectId, key, dirbuf, didread, total)) {
+            return UPNP_E_SUCCESS;
+        }
+        auto entry = std::make_shared<BrowseCacheEntry>();
+        ret = browseSlice(objectId, offset, count, entry->content, &entry->didread,
+                          &entry->total, proj, nullptr, sortcrit);
+        if (ret == UPNP_E_SUCCESS) {
+            *didread = entry->didread;
+            *total = entry->total;
+            appendDir(dirbuf, entry->content);
+            cachePut(getDeviceId(), gen, {objectId}, key, entry);
+        }
+    }
+    if (sortFailed(ret, sortcrit)) {
+        return sortedSlice(objectId, nullptr, offset, count, &dirbuf, nullptr, didread, total,
+                           proj, sortcrit);
+    }
+    return ret;
+}
+
+int ContentDirectory::readDirSlice(
+    const string& objectId, int offset, int count, UPnPDirContent& dirbuf, int *didread,
+    int *total)
+{
+    return readDirSlice(objectId, offset, count, dirbuf, didread, total, nullptr);
+}
+
+int ContentDirectory::readDirSlice(
+    const string& objectId, int offset, int count, vector<UPnPDirObject>& entries,
+    int *didread, int *total, const UPnPDirProjection *proj, const string& sortcrit)
+{
+    if (!sortcrit.empty() && !canSort(sortcrit)) {
+        return sortedSlice(objectId, nullptr, offset, count, nullptr, &entries, didread, total,
+                           proj, sortcrit);
+    }
+    UPnPDirContent dummy;
+    UPnPDirContent::Visitor visitor = [&entries] (UPnPDirObject& obj) {
+        entries.push_back(std::move(obj));
+        return true;
+    };
+    int ret = browseSlice(objectId, offset, count, dummy, didread, total, proj, &visitor,
+                          sortcrit);
+    if (sortFailed(ret, sortcrit)) {
+        return sortedSlice(objectId, nullptr, offset, count, nullptr, &entries, didread, total,
+                           proj, sortcrit);
+    }
+    return ret;
+}
+
+int ContentDirectory::browseSlice(
+    const string& objectId, int offset, int count, UPnPDirContent& dirbuf, int *didread,
+    int *total, const UPnPDirProjection *proj, const UPnPDirContent::Visitor *visitor,
+    const string& sortcrit)
 {
     LOGDEB("CDService::readDirSlice: objId [" << objectId << "] offset " <<
            offset << " count " << count << "\n");
 
     // Create request
     // Some devices require an empty SortCriteria, else bad params
+    const string& filter = requestFilter(proj);
     SoapOutgoing args(getServiceType(), "Browse");
     args("ObjectID", objectId)
     ("BrowseFlag", "BrowseDirectChildren")
-    ("Filter", "*")
-    ("SortCriteria", "")
+    ("Filter", filter)
+    ("SortCriteria", sortcrit)
     ("StartingIndex", SoapHelp::i2s(offset))
     ("RequestedCount", SoapHelp::i2s(count));
 
     SoapIncoming data;
+    auto start = std::chrono::steady_clock::now();
     int ret = runAction(args, data);
     if (ret != UPNP_E_SUCCESS) {
+        // With a sort, let the caller decide: the sort is the more likely culprit.
+        if (sortcrit.empty() && filterFailed(ret, filter)) {
+            return filterRetried(
+                browseSlice(objectId, offset, count, dirbuf, didread, total, proj, visitor));
+        }
         return ret;
     }
 
@@ -197,6 +1009,10 @@ int ContentDirectory::readDirSlice(
         return UPNP_E_BAD_RESPONSE;
     }
 
+    if (*didread == 0 && *total == 0 && offset > 0) {
+        // End of a list the size of which the server did not tell us.
+        return UPNP_E_SUCCESS;
+    }
     if (*didread <= 0) {
         LOGINF("CDService::readDir: got -1 or 0 entries\n");
         return UPNP_E_BAD_RESPONSE;
@@ -204,48 +1020,389 @@ int ContentDirectory::readDirSlice(
 
     LOGDEB0("ContentDirectory::readDirSlice: got count " << count <<
             " offset " << offset << " total " << *total << " Data:\n" << tbuf << "\n");
+    sliceSample(count, *didread, offset + *didread < *total, tbuf.size(),
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start).count());
 
-    dirbuf.parse(tbuf);
+    if (visitor) {
+        UPnPDirContent::parseWithVisitor(std::move(tbuf), *visitor, false, proj);
+    } else {
+        dirbuf.parse(std::move(tbuf), false, proj);
+    }
 
     return UPNP_E_SUCCESS;
 }
 
-int ContentDirectory::readDir(const string& objectId, UPnPDirContent& dirbuf)
+// Read one slice: readDirSlice() or searchSlice() with the fixed arguments bound.
+typedef std::function<int (int offset, int count, UPnPDirContent& dirbuf,
+                           int *didread, int *total)> SliceReader;
+
+// Called for each slice, in order, with the number of entries read up to now and the total
+// count. Return false to stop.
+typedef std::function<bool (UPnPDirContent& slice, int done, int total)> SliceVisitor;
+
+// Read the rest of a list the size of which is unknown, one slice at a time, after the first
+// slice which got done entries.
+static int readSequential(const SliceReader& reader, int slicesize, int done,
+                          UPnPDirContent& dirbuf, const SliceVisitor *visitor,
+                          const std::atomic<bool> *cancel)
 {
-    LOGDEB("CDService::readDir: url [" << getActionURL() << "] type [" <<
-           getServiceType() << "] udn [" << getDeviceId() << "] objId [" <<
-           objectId << "\n");
+    for (;;) {
+        if (cancel && *cancel) {
+            return UPNP_E_CANCELED;
+        }
+        UPnPDirContent slice;
+        int count = 0;
+        int total = 0;
+        int ret = reader(done, slicesize, visitor ? slice : dirbuf, &count, &total);
+        if (ret != UPNP_E_SUCCESS) {
+            return ret;
+        }
+        if (count <= 0) {
+            return UPNP_E_SUCCESS;
+        }
+        done += count;
+        if (visitor && !(*visitor)(slice, done, total)) {
+            return UPNP_E_CANCELED;
+        }
+        if (count < slicesize) {
+            return UPNP_E_SUCCESS;
+        }
+    }
+}
+
+// Read a full container or search result. The first slice is read alone, to get the total
+// count. The rest is split into slices which are fetched by up to maxconc threads. Each thread
+// parses its own data, so that parsing overlaps with the other requests. The slices are
+// collected in order as they become available, and either appended to dirbuf or handed to the
+// visitor (dirbuf is then only used for the first slice). If cancel is set, it is checked before
+// each request.
+static int readAllSlices(const SliceReader& reader, int slicesize, int maxconc,
+                         UPnPDirContent& dirbuf, const SliceVisitor *visitor = nullptr,
+                         const std::atomic<bool> *cancel = nullptr)
+{
+    if (cancel && *cancel) {
+        return UPNP_E_CANCELED;
+    }
+    int first = 0;
+    int total = 0;
+    int ret = reader(0, slicesize, dirbuf, &first, &total);
+    if (ret != UPNP_E_SUCCESS) {
+        return ret;
+    }
+    if (visitor && !(*visitor)(dirbuf, first, total)) {
+        return UPNP_E_CANCELED;
+    }
+    if (total == 0 && first == slicesize) {
+        // TotalMatches 0 means unknown for some servers. We can't split the rest, read
+        // sequentially until we get a short or empty slice.
+        return readSequential(reader, slicesize, first, dirbuf, visitor, cancel);
+    }
+    if (first <= 0 || first >= total) {
+        return UPNP_E_SUCCESS;
+    }
+    // Some servers cap the number of entries returned. Use this as the slice size, there is no
+    // point in asking for more.
+    slicesize = std::min(slicesize, first);
 
-    int offset = 0;
-    int total = 0;// Updated on first read.
+    int nslices = (total - first + slicesize - 1) / slicesize;
+    vector<UPnPDirContent> results(nslices);
+    vector<char> ready(nslices, 0);
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::atomic<int> nextslice{0};
+    std::atomic<int> error{UPNP_E_SUCCESS};
+    std::atomic<bool> stop{false};
+    auto stopped = [&] () {
+        return stop || (cancel && *cancel);
+    };
+    auto worker = [&] () {
+        for (int idx = nextslice++; idx < nslices && !stopped(); idx = nextslice++) {
+            int offset = first + idx * slicesize;
+            int end = std::min(offset + slicesize, total);
+            // Loop in case we get less than we asked for
+            while (offset < end && !stopped()) {
+                int count = 0;
+                int ntotal;
+                int ret = reader(offset, end - offset, results[idx], &count, &ntotal);
+                if (ret != UPNP_E_SUCCESS) {
+                    error = ret;
+                    stop = true;
+                    break;
+                }
+                if (count <= 0) {
+                    // Container shrank while we were reading ?
+                    break;
+                }
+                offset += count;
+            }
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready[idx] = 1;
+            }
+            cond.notify_all();
+        }
+    };
 
-    while (total == 0 || (offset < total)) {
-        int count;
-        int error = readDirSlice(objectId, offset, m_rdreqcnt, dirbuf, &count, &total);
-        if (error != UPNP_E_SUCCESS)
-            return error;
+    int nthreads = std::min(maxconc, nslices);
+    vector<std::thread> threads;
+    for (int i = 0; i < nthreads; i++) {
+        threads.emplace_back(worker);
+    }
 
-        offset += count;
-        if (count != m_rdreqcnt)
+    int done = first;
+    bool visitorstop{false};
+    for (int idx = 0; idx < nslices; idx++) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            // Timed wait because nobody signals an external cancellation.
+            while (!ready[idx] && !stopped()) {
+                cond.wait_for(lock, std::chrono::milliseconds(100));
+            }
+        }
+        if (stopped()) {
             break;
+        }
+        auto& result = results[idx];
+        done += static_cast<int>(result.m_containers.size() + result.m_items.size());
+        if (visitor) {
+            if (!(*visitor)(result, done, total)) {
+                visitorstop = true;
+                break;
+            }
+            result.clear();
+        } else {
+            appendDir(dirbuf, std::move(result));
+        }
+    }
+    stop = true;
+    for (auto& thr : threads) {
+        thr.join();
+    }
+    if (error != UPNP_E_SUCCESS) {
+        return error;
+    }
+    if (visitorstop || (cancel && *cancel)) {
+        return UPNP_E_CANCELED;
+    }
+    return UPNP_E_SUCCESS;
+}
+
+int ContentDirectory::readDir(const string& objectId, UPnPDirContent& dirbuf,
+                              const UPnPDirProjection *proj, const string& sortcrit)
+{
+    LOGDEB("CDService::readDir: url [" << getActionURL() << "] type [" <<
+           getServiceType() << "] udn [" << getDeviceId() << "] objId [" <<
+           objectId << "] sort [" << sortcrit << "]\n");
+
+    if (sortcrit.empty()) {
+        return readDirInt(objectId, dirbuf, proj, sortcrit);
+    }
+    if (canSort(sortcrit)) {
+        int ret = readDirInt(objectId, dirbuf, proj, sortcrit);
+        if (!sortFailed(ret, sortcrit)) {
+            return ret;
+        }
     }
+    return readSorted(objectId, nullptr, dirbuf, proj, sortcrit);
+}
+
+int ContentDirectory::readDir(const string& objectId, UPnPDirContent& dirbuf)
+{
+    return readDir(objectId, dirbuf, nullptr);
+}
 
+// How long we keep an unused locally sorted listing, see sortedSlice()
+static const int sorted_keep_secs = 60;
+
+// Read everything, then sort locally, for servers which can't sort. Container listings are
+// cached as the server-sorted ones would be.
+int ContentDirectory::readSorted(const string& objectId, const string *ss,
+                                 UPnPDirContent& dirbuf, const UPnPDirProjection *proj,
+                                 const string& sortcrit)
+{
+    uint64_t gen;
+    bool usecache = nullptr == ss && m_cacheon && cacheGeneration(getDeviceId(), &gen);
+    string key;
+    if (usecache) {
+        key = cacheKey("D", objectId, proj, sortcrit);
+        if (cacheGet(getDeviceId(), objectId, key, dirbuf)) {
+            return UPNP_E_SUCCESS;
+        }
+    }
+    auto entry = std::make_shared<BrowseCacheEntry>();
+    int ret = ss ? searchInt(objectId, *ss, entry->content, proj, string()) :
+        readDirInt(objectId, entry->content, proj, string());
+    if (ret != UPNP_E_SUCCESS) {
+        return ret;
+    }
+    sortEntries(entry->content.m_containers, sortcrit);
+    sortEntries(entry->content.m_items, sortcrit);
+    if (usecache) {
+        appendDir(dirbuf, entry->content);
+        cachePut(getDeviceId(), gen, {objectId}, key, entry);
+    } else {
+        appendDir(dirbuf, std::move(entry->content));
+    }
     return UPNP_E_SUCCESS;
 }
 
+// Slice from a locally sorted list: the sorted containers, then the sorted items. The entries
+// go to dirbuf or entries, whichever is set. The sorted list is kept for reading the next slices,
+// whatever their order: it is only read again for a different request, after an update event, or
+// if it was not used for a while.
+int ContentDirectory::sortedSlice(const string& objectId, const string *ss, int offset,
+                                  int count, UPnPDirContent *dirbuf,
+                                  vector<UPnPDirObject> *entries, int *didread, int *total,
+                                  const UPnPDirProjection *proj, const string& sortcrit)
+{
+    string key = cacheKey(ss ? "Q" : "D", objectId, proj, sortcrit);
+    if (ss) {
+        key.append(1, '\n').append(*ss);
+    }
+    std::shared_ptr<const UPnPDirContent> all;
+    auto now = std::chrono::steady_clock::now();
+    {
+        std::unique_lock<std::mutex> lock(m_sortedmutex);
+        if (key == m_sortedkey && now - m_sortedused < std::chrono::seconds(sorted_keep_secs)) {
+            all = m_sorted;
+            m_sortedused = now;
+        }
+    }
+    if (!all) {
+        auto content = std::make_shared<UPnPDirContent>();
+        int ret = readSorted(objectId, ss, *content, proj, sortcrit);
+        if (ret != UPNP_E_SUCCESS) {
+            return ret;
+        }
+        std::unique_lock<std::mutex> lock(m_sortedmutex);
+        m_sortedkey = key;
+        m_sorted = content;
+        m_sortedused = now;
+        all = content;
+    }
+    int ncont = static_cast<int>(all->m_containers.size());
+    *total = ncont + static_cast<int>(all->m_items.size());
+    *didread = 0;
+    for (int i = std::max(offset, 0); i < *total && (count <= 0 || i < offset + count); i++) {
+        const UPnPDirObject& obj = i < ncont ? all->m_containers[i] : all->m_items[i - ncont];
+        if (entries) {
+            entries->push_back(obj);
+        } else if (i < ncont) {
+            dirbuf->m_containers.push_back(obj);
+        } else {
+            dirbuf->m_items.push_back(obj);
+        }
+        (*didread)++;
+    }
+    // Same as the server requests: an empty Browse result is an error, not an empty Search.
+    return *didread > 0 || ss ? UPNP_E_SUCCESS : UPNP_E_BAD_RESPONSE;
+}
+
+int ContentDirectory::readDirInt(const string& objectId, UPnPDirContent& dirbuf,
+                                 const UPnPDirProjection *proj, const string& sortcrit)
+{
+    auto reader = [&] (int offset, int count, UPnPDirContent& buf, int *didread, int *total) {
+        return browseSlice(objectId, offset, count, buf, didread, total, proj, nullptr,
+                           sortcrit);
+    };
+    uint64_t gen;
+    if (!m_cacheon || !cacheGeneration(getDeviceId(), &gen)) {
+        return readAllSlices(reader, m_rdreqcnt, m_maxconc, dirbuf);
+    }
+    size_t firstcont = dirbuf.m_containers.size();
+    string key = cacheKey("D", objectId, proj, sortcrit);
+    int ret = UPNP_E_SUCCESS;
+    if (!cacheGet(getDeviceId(), objectId, key, dirbuf)) {
+        // Use the prefetched first slice if there is one.
+        string pkey = cacheKey("P", objectId, proj, sortcrit);
+        auto cachedreader = [&] (int offset, int count, UPnPDirContent& buf, int *didread,
+                                 int *total) {
+            if (offset == 0 && cacheGet(getDeviceId(), objectId, pkey, buf, didread, total)) {
+                return int(UPNP_E_SUCCESS);
+            }
+            return reader(offset, count, buf, didread, total);
+        };
+        auto entry = std::make_shared<BrowseCacheEntry>();
+        if (m_prefetcher) {
+            m_prefetcher->foregroundStart();
+        }
+        ret = readAllSlices(cachedreader, m_rdreqcnt, m_maxconc, entry->content);
+        if (m_prefetcher) {
+            m_prefetcher->foregroundEnd();
+        }
+        if (ret == UPNP_E_SUCCESS) {
+            appendDir(dirbuf, entry->content);
+            cachePut(getDeviceId(), gen, {objectId}, key, entry);
+        }
+    }
+    // The prefetched slices are unsorted: they would not be used for sorted requests.
+    if (ret == UPNP_E_SUCCESS && m_prefetcher && sortcrit.empty()) {
+        prefetchChildren(dirbuf, firstcont, proj);
+    }
+    return ret;
+}
+
+int ContentDirectory::searchSlice(
+    const string& objectId, const string& ss, int offset, int count,
+    UPnPDirContent& dirbuf, int *didread, int *total, const UPnPDirProjection *proj,
+    const string& sortcrit)
+{
+    int ret = UPNP_E_SUCCESS;
+    if (sortcrit.empty() || canSort(sortcrit)) {
+        ret = searchSliceInt(objectId, ss, offset, count, dirbuf, didread, total, proj, nullptr,
+                             sortcrit);
+        if (!sortFailed(ret, sortcrit)) {
+            return ret;
+        }
+    }
+    return sortedSlice(objectId, &ss, offset, count, &dirbuf, nullptr, didread, total, proj,
+                       sortcrit);
+}
+
 int ContentDirectory::searchSlice(
     const string& objectId, const string& ss, int offset, int count,
     UPnPDirContent& dirbuf, int *didread, int *total)
+{
+    return searchSlice(objectId, ss, offset, count, dirbuf, didread, total, nullptr);
+}
+
+int ContentDirectory::searchSlice(
+    const string& objectId, const string& ss, int offset, int count,
+    vector<UPnPDirObject>& entries, int *didread, int *total, const UPnPDirProjection *proj,
+    const string& sortcrit)
+{
+    if (sortcrit.empty() || canSort(sortcrit)) {
+        UPnPDirContent dummy;
+        UPnPDirContent::Visitor visitor = [&entries] (UPnPDirObject& obj) {
+            entries.push_back(std::move(obj));
+            return true;
+        };
+        int ret = searchSliceInt(objectId, ss, offset, count, dummy, didread, total, proj,
+                                 &visitor, sortcrit);
+        if (!sortFailed(ret, sortcrit)) {
+            return ret;
+        }
+    }
+    return sortedSlice(objectId, &ss, offset, count, nullptr, &entries, didread, total, proj,
+                       sortcrit);
+}
+
+int ContentDirectory::searchSliceInt(
+    const string& objectId, const string& ss, int offset, int count, UPnPDirContent& dirbuf,
+    int *didread, int *total, const UPnPDirProjection *proj,
+    const UPnPDirContent::Visitor *visitor, const string& sortcrit)
 {
     LOGDEB("CDService::searchSlice: objId [" << objectId << "] offset " <<
            offset << " count " << count << "\n");
 
     // Create request
+    const string& filter = requestFilter(proj);
     SoapOutgoing args(getServiceType(), "Search");
     args("ContainerID", objectId)
     ("SearchCriteria", ss)
-    ("Filter", "*")
-    ("SortCriteria", "")
+    ("Filter", filter)
+    ("SortCriteria", sortcrit)
     ("StartingIndex", SoapHelp::i2s(offset))
     ("RequestedCount", SoapHelp::i2s(count));
 
@@ -253,6 +1410,10 @@ int ContentDirectory::searchSlice(
     int ret = runAction(args, data);
 
     if (ret != UPNP_E_SUCCESS) {
+        if (sortcrit.empty() && filterFailed(ret, filter)) {
+            return filterRetried(searchSliceInt(objectId, ss, offset, count, dirbuf, didread,
+                                                total, proj, visitor));
+        }
         LOGINF("CDService::search: UpnpSendAction failed: " << UpnpGetErrorMessage(ret) << "\n");
         return ret;
     }
@@ -269,33 +1430,209 @@ int ContentDirectory::searchSlice(
         return count < 0 ? UPNP_E_BAD_RESPONSE : UPNP_E_SUCCESS;
     }
 
-    dirbuf.parse(tbuf);
+    if (visitor) {
+        UPnPDirContent::parseWithVisitor(std::move(tbuf), *visitor, false, proj);
+    } else {
+        dirbuf.parse(std::move(tbuf), false, proj);
+    }
 
     return UPNP_E_SUCCESS;
 }
 
 int ContentDirectory::search(
-    const string& objectId, const string& ss, UPnPDirContent& dirbuf)
+    const string& objectId, const string& ss, UPnPDirContent& dirbuf,
+    const UPnPDirProjection *proj, const string& sortcrit)
 {
     LOGDEB("CDService::search: url [" << getActionURL() << "] type [" <<
            getServiceType() << "] udn [" << getDeviceId() << "] objid [" <<
-           objectId <<  "] search [" << ss << "]\n");
-
-    int offset = 0;
-    int total = 0;// Updated on first read.
-
-    while (total == 0 || (offset < total)) {
-        int count;
-        int error = searchSlice(objectId, ss, offset, m_rdreqcnt, dirbuf,
-                                &count, &total);
-        if (error != UPNP_E_SUCCESS)
-            return error;
-        if (count != m_rdreqcnt)
-            break;
-        offset += count;
+           objectId <<  "] search [" << ss << "] sort [" << sortcrit << "]\n");
+
+    if (sortcrit.empty() || canSort(sortcrit)) {
+        int ret = searchInt(objectId, ss, dirbuf, proj, sortcrit);
+        if (!sortFailed(ret, sortcrit)) {
+            return ret;
+        }
     }
+    return readSorted(objectId, &ss, dirbuf, proj, sortcrit);
+}
 
-    return UPNP_E_SUCCESS;
+int ContentDirectory::search(const string& objectId, const string& ss, UPnPDirContent& dirbuf)
+{
+    return search(objectId, ss, dirbuf, nullptr);
+}
+
+int ContentDirectory::searchInt(
+    const string& objectId, const string& ss, UPnPDirContent& dirbuf,
+    const UPnPDirProjection *proj, const string& sortcrit)
+{
+    return readAllSlices(
+        [&] (int offset, int count, UPnPDirContent& buf, int *didread, int *total) {
+            return searchSliceInt(objectId, ss, offset, count, buf, didread, total, proj,
+                                  nullptr, sortcrit);
+        },
+        m_rdreqcnt, m_maxconc, dirbuf);
+}
+
+class ContentDirectory::AsyncRead::Internal {
+public:
+    std::thread thr;
+    std::atomic<bool> cancel{false};
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool done{false};
+    int status{UPNP_E_SUCCESS};
+    bool hasproj{false};
+    UPnPDirProjection proj;
+
+    void finish(int st) {
+        std::unique_lock<std::mutex> lock(mutex);
+        status = st;
+        done = true;
+        cond.notify_all();
+    }
+};
+
+ContentDirectory::AsyncRead::AsyncRead()
+    : m(std::make_shared<Internal>())
+{
+}
+
+ContentDirectory::AsyncRead::~AsyncRead()
+{
+    m->cancel = true;
+    if (m->thr.joinable()) {
+        // We may be deleted from a callback, in the operation thread.
+        if (m->thr.get_id() == std::this_thread::get_id()) {
+            m->thr.detach();
+        } else {
+            m->thr.join();
+        }
+    }
+}
+
+void ContentDirectory::AsyncRead::cancel()
+{
+    m->cancel = true;
+}
+
+bool ContentDirectory::AsyncRead::isDone()
+{
+    std::unique_lock<std::mutex> lock(m->mutex);
+    return m->done;
+}
+
+int ContentDirectory::AsyncRead::wait()
+{
+    std::unique_lock<std::mutex> lock(m->mutex);
+    m->cond.wait(lock, [this] {return m->done;});
+    return m->status;
+}
+
+// Locally sorted listing, delivered as a single slice. Used by the asynchronous reads when the
+// server can't sort.
+int ContentDirectory::sortedAsync(const string& objectId, const string *ss, SliceCB& slicecb,
+                                  const UPnPDirProjection *proj, const string& sortcrit,
+                                  std::atomic<bool>& cancel)
+{
+    UPnPDirContent buf;
+    int status = readSorted(objectId, ss, buf, proj, sortcrit);
+    if (status != UPNP_E_SUCCESS) {
+        return status;
+    }
+    if (cancel) {
+        return UPNP_E_CANCELED;
+    }
+    int count = static_cast<int>(buf.m_containers.size() + buf.m_items.size());
+    return slicecb(buf, count, count) ? UPNP_E_SUCCESS : UPNP_E_CANCELED;
+}
+
+std::shared_ptr<ContentDirectory::AsyncRead> ContentDirectory::readDirAsync(
+    const string& objectId, SliceCB slicecb, DoneCB donecb, const UPnPDirProjection *proj,
+    const string& sortcrit)
+{
+    LOGDEB("CDService::readDirAsync: udn [" << getDeviceId() << "] objId [" << objectId <<
+           "] sort [" << sortcrit << "]\n");
+    std::shared_ptr<AsyncRead> op(new AsyncRead());
+    auto opm = op->m;
+    if (proj) {
+        opm->hasproj = true;
+        opm->proj = *proj;
+    }
+    opm->thr = std::thread([this, opm, objectId, slicecb, donecb, sortcrit] () mutable {
+        const UPnPDirProjection *proj = opm->hasproj ? &opm->proj : nullptr;
+        UPnPDirContent buf;
+        int status;
+        if (m_cacheon &&
+            cacheGet(getDeviceId(), objectId, cacheKey("D", objectId, proj, sortcrit), buf)) {
+            int count = static_cast<int>(buf.m_containers.size() + buf.m_items.size());
+            status = slicecb(buf, count, count) ? UPNP_E_SUCCESS : UPNP_E_CANCELED;
+        } else if (!sortcrit.empty() && !canSort(sortcrit)) {
+            status = sortedAsync(objectId, nullptr, slicecb, proj, sortcrit, opm->cancel);
+        } else {
+            bool delivered{false};
+            SliceVisitor visitor = [&] (UPnPDirContent& slice, int didread, int total) {
+                delivered = true;
+                return slicecb(slice, didread, total);
+            };
+            status = readAllSlices(
+                [&] (int offset, int count, UPnPDirContent& buf, int *didread, int *total) {
+                    return browseSlice(objectId, offset, count, buf, didread, total, proj,
+                                       nullptr, sortcrit);
+                },
+                m_rdreqcnt, m_maxconc, buf, &visitor, &opm->cancel);
+            // Only fall back if the client did not get anything yet.
+            if (!delivered && sortFailed(status, sortcrit)) {
+                status = sortedAsync(objectId, nullptr, slicecb, proj, sortcrit, opm->cancel);
+            }
+        }
+        if (donecb) {
+            donecb(status);
+        }
+        opm->finish(status);
+    });
+    return op;
+}
+
+std::shared_ptr<ContentDirectory::AsyncRead> ContentDirectory::searchAsync(
+    const string& objectId, const string& ss, SliceCB slicecb, DoneCB donecb,
+    const UPnPDirProjection *proj, const string& sortcrit)
+{
+    LOGDEB("CDService::searchAsync: udn [" << getDeviceId() << "] objId [" << objectId <<
+           "] search [" << ss << "] sort [" << sortcrit << "]\n");
+    std::shared_ptr<AsyncRead> op(new AsyncRead());
+    auto opm = op->m;
+    if (proj) {
+        opm->hasproj = true;
+        opm->proj = *proj;
+    }
+    opm->thr = std::thread([this, opm, objectId, ss, slicecb, donecb, sortcrit] () mutable {
+        const UPnPDirProjection *proj = opm->hasproj ? &opm->proj : nullptr;
+        int status;
+        if (!sortcrit.empty() && !canSort(sortcrit)) {
+            status = sortedAsync(objectId, &ss, slicecb, proj, sortcrit, opm->cancel);
+        } else {
+            UPnPDirContent buf;
+            bool delivered{false};
+            SliceVisitor visitor = [&] (UPnPDirContent& slice, int didread, int total) {
+                delivered = true;
+                return slicecb(slice, didread, total);
+            };
+            status = readAllSlices(
+                [&] (int offset, int count, UPnPDirContent& buf, int *didread, int *total) {
+                    return searchSliceInt(objectId, ss, offset, count, buf, didread, total,
+                                          proj, nullptr, sortcrit);
+                },
+                m_rdreqcnt, m_maxconc, buf, &visitor, &opm->cancel);
+            if (!delivered && sortFailed(status, sortcrit)) {
+                status = sortedAsync(objectId, &ss, slicecb, proj, sortcrit, opm->cancel);
+            }
+        }
+        if (donecb) {
+            donecb(status);
+        }
+        opm->finish(status);
+    });
+    return op;
 }
 
 int ContentDirectory::getSearchCapabilities(set<string>& result)
@@ -329,23 +1666,73 @@ int ContentDirectory::getSearchCapabilities(set<string>& result)
     return UPNP_E_SUCCESS;
 }
 
+int ContentDirectory::getSortCapabilities(set<string>& result)
+{
+    LOGDEB("CDService::getSortCapabilities:\n");
+
+    SoapOutgoing args(getServiceType(), "GetSortCapabilities");
+    SoapIncoming data;
+    int ret = runAction(args, data);
+    if (ret != UPNP_E_SUCCESS) {
+        LOGINF("CDService::getSortCapa: UpnpSendAction failed: " <<
+               UpnpGetErrorMessage(ret) << "\n");
+        return ret;
+    }
+    string tbuf;
+    if (!data.get("SortCaps", &tbuf)) {
+        LOGERR("CDService::getSortCaps: missing Result in response\n");
+        return UPNP_E_BAD_RESPONSE;
+    }
+
+    result.clear();
+    if (tbuf == "*") {
+        result.insert(result.end(), "*");
+    } else if (!tbuf.empty()) {
+        if (!csvToStrings(tbuf, result)) {
+            return UPNP_E_BAD_RESPONSE;
+        }
+    }
+
+    return UPNP_E_SUCCESS;
+}
+
+int ContentDirectory::getSystemUpdateID(int *id)
+{
+    LOGDEB("CDService::getSystemUpdateID:\n");
+    return runSimpleGet("GetSystemUpdateID", "Id", id);
+}
+
 int ContentDirectory::getMetadata(const string& objectId,
-                                  UPnPDirContent& dirbuf)
+                                  UPnPDirContent& dirbuf, const UPnPDirProjection *proj)
 {
     LOGDEB("CDService::getMetadata: url [" << getActionURL() << "] type [" <<
            getServiceType() << "] udn [" << getDeviceId() << "] objId [" <<
            objectId << "]\n");
 
+    uint64_t gen{0};
+    bool usecache = m_cacheon && cacheGeneration(getDeviceId(), &gen);
+    string key;
+    if (usecache) {
+        key = cacheKey("M", objectId, proj, "");
+        if (cacheGet(getDeviceId(), objectId, key, dirbuf)) {
+            return UPNP_E_SUCCESS;
+        }
+    }
+
+    const string& filter = requestFilter(proj);
     SoapOutgoing args(getServiceType(), "Browse");
     SoapIncoming data;
     args("ObjectID", objectId)
     ("BrowseFlag", "BrowseMetadata")
-    ("Filter", "*")
+    ("Filter", filter)
     ("SortCriteria", "")
     ("StartingIndex", "0")
     ("RequestedCount", "1");
     int ret = runAction(args, data);
     if (ret != UPNP_E_SUCCESS) {
+        if (filterFailed(ret, filter)) {
+            return filterRetried(getMetadata(objectId, dirbuf, proj));
+        }
         LOGINF("CDService::getmetadata: UpnpSendAction failed: " <<
                UpnpGetErrorMessage(ret) << "\n");
         return ret;
@@ -356,10 +1743,96 @@ int ContentDirectory::getMetadata(const string& objectId,
         return UPNP_E_BAD_RESPONSE;
     }
 
-    if (dirbuf.parse(tbuf))
-        return UPNP_E_SUCCESS;
-    else
+    if (!usecache) {
+        if (dirbuf.parse(std::move(tbuf), false, proj))
+            return UPNP_E_SUCCESS;
+        else
+            return UPNP_E_BAD_RESPONSE;
+    }
+
+    auto entry = std::make_shared<BrowseCacheEntry>();
+    if (!entry->content.parse(std::move(tbuf), false, proj)) {
         return UPNP_E_BAD_RESPONSE;
+    }
+    appendDir(dirbuf, entry->content);
+    // The object data may change with its own updates (e.g. childCount for a container) or
+    // with its parent's.
+    vector<string> ids{objectId};
+    for (const auto *objs : {&entry->content.m_containers, &entry->content.m_items}) {
+        for (const auto& obj : *objs) {
+            if (!obj.m_pid.empty() && obj.m_pid != objectId) {
+                ids.push_back(obj.m_pid);
+            }
+        }
+    }
+    cachePut(getDeviceId(), gen, ids, key, entry);
+    return UPNP_E_SUCCESS;
+}
+
+int ContentDirectory::getMetadata(const string& objectId, UPnPDirContent& dirbuf)
+{
+    return getMetadata(objectId, dirbuf, nullptr);
+}
+
+int ContentDirectory::getMetadata(const vector<string>& objectIds,
+                                  unordered_map<string, UPnPDirObject>& results,
+                                  const UPnPDirProjection *proj,
+                                  unordered_map<string, int> *errors, int maxconc)
+{
+    LOGDEB("CDService::getMetadata: udn [" << getDeviceId() << "] " << objectIds.size() <<
+           " objects\n");
+    vector<string> ids;
+    set<string> seen;
+    for (const auto& id : objectIds) {
+        if (seen.insert(id).second) {
+            ids.push_back(id);
+        }
+    }
+
+    // Each slot is only written by the thread which took its index.
+    vector<UPnPDirObject> objs(ids.size());
+    vector<int> status(ids.size(), UPNP_E_SUCCESS);
+    std::atomic<size_t> next{0};
+    auto worker = [&] () {
+        for (size_t i = next++; i < ids.size(); i = next++) {
+            UPnPDirContent dirbuf;
+            int ret = getMetadata(ids[i], dirbuf, proj);
+            if (ret == UPNP_E_SUCCESS) {
+                if (!dirbuf.m_containers.empty()) {
+                    objs[i] = std::move(dirbuf.m_containers[0]);
+                } else if (!dirbuf.m_items.empty()) {
+                    objs[i] = std::move(dirbuf.m_items[0]);
+                } else {
+                    ret = UPNP_E_BAD_RESPONSE;
+                }
+            }
+            status[i] = ret;
+        }
+    };
+    size_t nthreads = std::min(ids.size(), static_cast<size_t>(maxconc > 0 ? maxconc : m_maxconc));
+    vector<std::thread> threads;
+    for (size_t i = 1; i < nthreads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thr : threads) {
+        thr.join();
+    }
+
+    int ret = UPNP_E_SUCCESS;
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (status[i] == UPNP_E_SUCCESS) {
+            results[ids[i]] = std::move(objs[i]);
+        } else {
+            if (ret == UPNP_E_SUCCESS) {
+                ret = status[i];
+            }
+            if (errors) {
+                (*errors)[ids[i]] = status[i];
+            }
+        }
+    }
+    return ret;
 }
 
 } // namespace UPnPClient
@@ -18,6 +18,9 @@
 #ifndef _UPNPDIR_HXX_INCLUDED_
 #define _UPNPDIR_HXX_INCLUDED_
 
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <unordered_map>
 #include <set>
 #include <string>
@@ -49,12 +52,19 @@ typedef std::shared_ptr<ContentDirectory> CDSH;
  *
  * The value chosen may be affected by the UpnpSetMaxContentLength
  * (2000*1024) done during initialization, but this should be ample.
+ *
+ * The slice size is adjusted while reading, from the measured request
+ * durations and response sizes, and from the server NumberReturned
+ * limits. The learned values are shared by all the servers with the
+ * same manufacturer and model, and can be saved and restored across
+ * sessions with saveSliceSizes() and loadSliceSizes().
  */
 class UPNPP_API ContentDirectory : public Service {
 public:
 
     /** Construct by copying data from device and service objects. */
     ContentDirectory(const UPnPDeviceDesc& dev, const UPnPServiceDesc& srv);
+    ~ContentDirectory() override;
 
     enum ServiceKind {CDSKIND_UNKNOWN, CDSKIND_BUBBLE, CDSKIND_MEDIATOMB,
                       CDSKIND_MINIDLNA, CDSKIND_MINIM, CDSKIND_TWONKY
@@ -75,12 +85,34 @@ public:
     static bool getServerByName(const std::string& friendlyName,
                                 CDSH& server);
 
+    /* About the proj (UPnPDirProjection) parameter to the read and search methods below: the
+     * projection spec is sent to the server as the request Filter argument, so that it does not
+     * bother producing the data that we don't need. It is also applied locally while parsing the
+     * result, for servers which ignore the Filter. If a server returns an error for a request
+     * with a restricted Filter, we retry with "*" and don't send the filter any more.
+     *
+     * About the sortcrit parameter: this is an UPnP SortCriteria string, a comma-separated list
+     * of properties, each preceded by + or - for the direction ("+upnp:artist,-dc:date"). It
+     * is sent to the server if all the properties are in its sort capabilities
+     * (getSortCapabilities(), asked once). Else, or if the server then fails the request, the
+     * entries are sorted locally (see sortEntries()). A local sort needs all the entries: the
+     * slice methods then read the full container or search result once, and the slices are
+     * taken from the sorted containers followed by the sorted items. The last sorted result is
+     * kept for the next slices of the same request until an update event arrives or it is not
+     * used for a minute. */
+
     /** Read a full container's children list
      *
      * @param objectId the UPnP object Id for the container. Root has Id "0"
      * @param[out] dirbuf stores the entries we read.
+     * @param proj if set, only the selected fields are stored in the entries.
+     * @param sortcrit if not empty, the sort order.
      * @return UPNP_E_SUCCESS for success, else libupnp error code.
      */
+    int readDir(const std::string& objectId, UPnPDirContent& dirbuf,
+                const UPnPDirProjection *proj,
+                const std::string& sortcrit = std::string());
+    /** Same as above, without projection or sort. Kept for binary compatibility. */
     int readDir(const std::string& objectId, UPnPDirContent& dirbuf);
 
     /** Read a partial slice of a container's children list
@@ -94,17 +126,58 @@ public:
      *        appended to the existing ones.
      * @param[out] didread number of entries actually read.
      * @param[out] total total number of children.
+     * @param proj if set, only the selected fields are stored in the entries.
+     * @param sortcrit if not empty, the sort order.
      * @return UPNP_E_SUCCESS for success, else libupnp error code.
      */
+    int readDirSlice(const std::string& objectId, int offset,
+                     int count, UPnPDirContent& dirbuf,
+                     int *didread, int *total,
+                     const UPnPDirProjection *proj,
+                     const std::string& sortcrit = std::string());
+    /** Same as above, without projection or sort. Kept for binary compatibility. */
     int readDirSlice(const std::string& objectId, int offset,
                      int count, UPnPDirContent& dirbuf,
                      int *didread, int *total);
 
+    /** Same as above, but append the entries to a single vector, in the server order
+     * (UPnPDirContent separates the containers and the items). The cache is not used. */
+    int readDirSlice(const std::string& objectId, int offset, int count,
+                     std::vector<UPnPDirObject>& entries, int *didread, int *total,
+                     const UPnPDirProjection *proj = nullptr,
+                     const std::string& sortcrit = std::string());
+
     int goodSliceSize()
     {
         return m_rdreqcnt;
     }
 
+    /** Set the maximum number of concurrent requests used by readDir() and search().
+     *
+     * After the first slice, which gives the total count, the remaining slices are fetched in
+     * parallel by this many threads, and the results assembled in order. Use 1 for servers
+     * which do not deal well with concurrent requests. The default is 3.
+     */
+    void setReadConcurrency(int maxconc)
+    {
+        m_maxconc = maxconc > 0 ? maxconc : 1;
+    }
+
+    /** Save the learned slice sizes for all the server models seen up to now.
+     *
+     * @param path file to write. This is a text file with one line per model.
+     * @return false for a file write error.
+     */
+    static bool saveSliceSizes(const std::string& path);
+
+    /** Load slice sizes previously saved by saveSliceSizes().
+     *
+     * This should be called before creating the ContentDirectory objects, which get their
+     * initial value when constructed.
+     * @return false if the file could not be read.
+     */
+    static bool loadSliceSizes(const std::string& path);
+
     /** Search the content directory service.
      *
      * @param objectId the UPnP object Id under which the search
@@ -114,25 +187,128 @@ public:
      * UPnP document: UPnP-av-ContentDirectory-v1-Service-20020625.pdf
      * section 2.5.5. Maybe we'll provide an easier way some day...
      * @param[out] dirbuf stores the entries we read.
+     * @param proj if set, only the selected fields are stored in the entries.
+     * @param sortcrit if not empty, the sort order.
      * @return UPNP_E_SUCCESS for success, else libupnp error code.
      */
+    int search(const std::string& objectId, const std::string& searchstring,
+               UPnPDirContent& dirbuf, const UPnPDirProjection *proj,
+               const std::string& sortcrit = std::string());
+    /** Same as above, without projection or sort. Kept for binary compatibility. */
     int search(const std::string& objectId, const std::string& searchstring,
                UPnPDirContent& dirbuf);
     /** Same to search() as readDirSlice to readDir() */
+    int searchSlice(const std::string& objectId,
+                    const std::string& searchstring,
+                    int offset, int count, UPnPDirContent& dirbuf,
+                    int *didread, int *total,
+                    const UPnPDirProjection *proj,
+                    const std::string& sortcrit = std::string());
+    /** Same as above, without projection or sort. Kept for binary compatibility. */
     int searchSlice(const std::string& objectId,
                     const std::string& searchstring,
                     int offset, int count, UPnPDirContent& dirbuf,
                     int *didread, int *total);
+    /** Same as above, with the entries in server order. See readDirSlice() */
+    int searchSlice(const std::string& objectId, const std::string& searchstring,
+                    int offset, int count, std::vector<UPnPDirObject>& entries,
+                    int *didread, int *total, const UPnPDirProjection *proj = nullptr,
+                    const std::string& sortcrit = std::string());
+
+    /** Handle for an asynchronous read started by readDirAsync() or searchAsync().
+     *
+     * Destroying the handle cancels the operation and waits for it to stop.
+     */
+    class UPNPP_API AsyncRead {
+    public:
+        ~AsyncRead();
+        AsyncRead(const AsyncRead&) = delete;
+        AsyncRead& operator=(const AsyncRead&) = delete;
+
+        /** Stop the operation. No more requests will be sent and no more slices delivered. A
+         * request in progress is not interrupted. */
+        void cancel();
+        /** Check if the operation is complete, successfully or not */
+        bool isDone();
+        /** Wait for the operation to complete.
+         * @return UPNP_E_SUCCESS, UPNP_E_CANCELED, or an error code. */
+        int wait();
+
+    private:
+        friend class ContentDirectory;
+        class UPNPP_LOCAL Internal;
+        AsyncRead();
+        std::shared_ptr<Internal> m;
+    };
+
+    /** Slice callback for the asynchronous reads. Called from the operation thread for each
+     * slice, in order. The entries can be moved out of @param slice.
+     * @param done number of entries read up to now, including this slice.
+     * @param total total number of entries (TotalMatches).
+     * @return false to cancel the operation. */
+    typedef std::function<bool (UPnPDirContent& slice, int done, int total)> SliceCB;
+    /** Completion callback. Called from the operation thread at the end. 
+     * @param status UPNP_E_SUCCESS, UPNP_E_CANCELED, or an error code. */
+    typedef std::function<void (int status)> DoneCB;
+
+    /** Asynchronous version of readDir().
+     *
+     * The read runs in a separate thread, and the entries are delivered by slices, in order,
+     * through the @param slicecb callback. The ContentDirectory object must not be deleted
+     * before the operation is complete.
+     *
+     * @param objectId the UPnP object Id for the container.
+     * @param slicecb called for each slice.
+     * @param donecb optional completion callback.
+     * @param proj optional projection, copied by the call.
+     * @param sortcrit optional sort order. If the entries are sorted locally, they are
+     *    delivered as a single slice.
+     * @return a handle to control or wait for the operation.
+     */
+    std::shared_ptr<AsyncRead> readDirAsync(const std::string& objectId, SliceCB slicecb,
+                                            DoneCB donecb = DoneCB(),
+                                            const UPnPDirProjection *proj = nullptr,
+                                            const std::string& sortcrit = std::string());
+
+    /** Asynchronous version of search(). See readDirAsync() */
+    std::shared_ptr<AsyncRead> searchAsync(const std::string& objectId,
+                                           const std::string& searchstring, SliceCB slicecb,
+                                           DoneCB donecb = DoneCB(),
+                                           const UPnPDirProjection *proj = nullptr,
+                                           const std::string& sortcrit = std::string());
 
     /** Read metadata for a given node.
      *
      * @param objectId the UPnP object Id. Root has Id "0"
      * @param[out] dirbuf stores the entries we read. At most one entry will be
      *   returned.
+     * @param proj if set, only the selected fields are stored in the entries.
      * @return UPNP_E_SUCCESS for success, else libupnp error code.
      */
+    int getMetadata(const std::string& objectId, UPnPDirContent& dirbuf,
+                    const UPnPDirProjection *proj);
+    /** Same as above, without projection. Kept for binary compatibility. */
     int getMetadata(const std::string& objectId, UPnPDirContent& dirbuf);
 
+    /** Read metadata for a list of nodes, e.g. to resolve a saved playlist.
+     *
+     * The requests are run concurrently, with a bounded number in flight. A failure for
+     * some ids does not prevent reading the others.
+     *
+     * @param objectIds the UPnP object Ids. Duplicates are only read once.
+     * @param[out] results the objects which could be read, by Id.
+     * @param proj if set, only the selected fields are stored in the entries.
+     * @param[out] errors if set, the error code for each Id which could not be read.
+     * @param maxconc maximum number of requests in flight. 0 to use the readDir() value
+     *    (see setReadConcurrency()).
+     * @return UPNP_E_SUCCESS if all the objects were read, else the error for the first Id in
+     *    the list which failed.
+     */
+    int getMetadata(const std::vector<std::string>& objectIds,
+                    std::unordered_map<std::string, UPnPDirObject>& results,
+                    const UPnPDirProjection *proj = nullptr,
+                    std::unordered_map<std::string, int> *errors = nullptr, int maxconc = 0);
+
     /** Retrieve search capabilities
      *
      * @param[out] result an empty vector: no search, or a single '*' element:
@@ -141,6 +317,70 @@ public:
      */
     int getSearchCapabilities(std::set<std::string>& result);
 
+    /** Retrieve sort capabilities
+     *
+     * @param[out] result an empty set: no sort, or a single '*' element:
+     *     any property can be used for sorting, or a list of usable property names.
+     * @return UPNP_E_SUCCESS for success, else libupnp error code.
+     */
+    int getSortCapabilities(std::set<std::string>& result);
+
+    /** Sort directory entries locally.
+     *
+     * The sort keys are computed once for each entry. The comparisons are case-insensitive,
+     * and numeric if both values are integers. The sort is stable.
+     *
+     * @param entries the entries to sort.
+     * @param sortcrit an UPnP SortCriteria string, e.g. "+upnp:artist,+dc:title". The
+     *    properties are element names, or "@id", "@parentID" or "res@attr" (resource
+     *    attribute, from the first resource).
+     */
+    static void sortEntries(std::vector<UPnPDirObject>& entries, const std::string& sortcrit);
+
+    /** Retrieve the current SystemUpdateID value.
+     *
+     * This changes whenever anything changes in the server tree, so it can be used to check
+     * that locally stored data is still current.
+     *
+     * @param[out] id the SystemUpdateID value.
+     * @return UPNP_E_SUCCESS for success, else libupnp error code.
+     */
+    int getSystemUpdateID(int *id);
+
+    /** Enable or disable the Browse result cache.
+     *
+     * When enabled, the results of readDir(), readDirSlice() and getMetadata() are kept in
+     * memory and reused for identical requests (same server, object, filter and sort order). The
+     * cache is shared by the ContentDirectory objects for the same server which have it
+     * enabled. It relies on the server events: this subscribes to the service if this was not
+     * already done by installReporter(). The ContainerUpdateIDs events invalidate the entries for
+     * the listed containers, and a SystemUpdateID change without ContainerUpdateIDs invalidates
+     * everything for the server.
+     *
+     * @param onoff enable or disable.
+     * @param maxobjects approximate maximum number of directory objects cached for this server.
+     *    The DIDL text kept with the objects for UPnPDirObject::getdidl() is also limited, to
+     *    an average of 2 KB per object.
+     * @return false if enabling failed because we could not subscribe to the events.
+     */
+    bool setCacheEnabled(bool onoff, size_t maxobjects = 20000);
+
+    /** Prefetch child containers in the background.
+     *
+     * After each readDir(), the first slice of the first @param ncontainers child containers
+     * which were returned is fetched by a background thread, one at a time, and only while no
+     * readDir() is running. A new readDir() call cancels the prefetches still pending from the
+     * previous one. The results are stored in the Browse cache and used by the next readDir()
+     * calls, so this only does something while the cache is enabled (see setCacheEnabled()).
+     *
+     * @param ncontainers number of child containers to prefetch. 0 to disable.
+     */
+    void setPrefetch(int ncontainers);
+
+    /** Install or uninstall the event reporter. Overridden to keep the event subscription
+     * active if the cache is enabled. */
+    void installReporter(VarEventReporter* reporter) override;
+
 protected:
     bool serviceInit(const UPnPDeviceDesc& device,
                      const UPnPServiceDesc& service) override;
@@ -148,8 +388,61 @@ protected:
     static const std::string SType;
 
 private:
-    int m_rdreqcnt{200}; // Slice size to use when reading
+    std::atomic<int> m_rdreqcnt{200}; // Slice size to use when reading
     ServiceKind m_serviceKind{CDSKIND_UNKNOWN};
+    int m_maxconc{3}; // Max concurrent requests for readDir() and search()
+    // Set to false if the server rejects restricted filters
+    std::atomic<bool> m_filterok{true};
+    // Set to false if the server fails a request which it should be able to sort
+    std::atomic<bool> m_sortok{true};
+    // Sort capabilities, asked on first use
+    std::mutex m_sortmutex;
+    bool m_sortcapsknown{false};
+    std::set<std::string> m_sortcaps;
+    // Last locally sorted listing, kept while the client pages through it with
+    // readDirSlice() or searchSlice(), and identified by its request key.
+    std::mutex m_sortedmutex;
+    std::string m_sortedkey;
+    std::shared_ptr<const UPnPDirContent> m_sorted;
+    std::chrono::steady_clock::time_point m_sortedused;
+    std::atomic<bool> m_cacheon{false};
+    class UPNPP_LOCAL Prefetcher;
+    Prefetcher *m_prefetcher{nullptr};
+
+    std::string UPNPP_LOCAL sliceKey();
+    void UPNPP_LOCAL sliceSample(int requested, int returned, bool more, size_t bytes, int ms);
+    UPNPP_LOCAL const std::string& requestFilter(const UPnPDirProjection *proj);
+    bool UPNPP_LOCAL filterFailed(int ret, const std::string& filter);
+    int UPNPP_LOCAL filterRetried(int ret);
+    bool UPNPP_LOCAL canSort(const std::string& sortcrit);
+    bool UPNPP_LOCAL sortFailed(int ret, const std::string& sortcrit);
+    int UPNPP_LOCAL browseSlice(const std::string& objectId, int offset, int count,
+                                UPnPDirContent& dirbuf, int *didread, int *total,
+                                const UPnPDirProjection *proj,
+                                const UPnPDirContent::Visitor *visitor = nullptr,
+                                const std::string& sortcrit = std::string());
+    int UPNPP_LOCAL searchSliceInt(const std::string& objectId, const std::string& ss,
+                                   int offset, int count, UPnPDirContent& dirbuf,
+                                   int *didread, int *total, const UPnPDirProjection *proj,
+                                   const UPnPDirContent::Visitor *visitor,
+                                   const std::string& sortcrit = std::string());
+    int UPNPP_LOCAL readDirInt(const std::string& objectId, UPnPDirContent& dirbuf,
+                               const UPnPDirProjection *proj, const std::string& sortcrit);
+    int UPNPP_LOCAL searchInt(const std::string& objectId, const std::string& ss,
+                              UPnPDirContent& dirbuf, const UPnPDirProjection *proj,
+                              const std::string& sortcrit);
+    int UPNPP_LOCAL readSorted(const std::string& objectId, const std::string *ss,
+                               UPnPDirContent& dirbuf, const UPnPDirProjection *proj,
+                               const std::string& sortcrit);
+    int UPNPP_LOCAL sortedSlice(const std::string& objectId, const std::string *ss,
+                                int offset, int count, UPnPDirContent *dirbuf,
+                                std::vector<UPnPDirObject> *entries, int *didread, int *total,
+                                const UPnPDirProjection *proj, const std::string& sortcrit);
+    int UPNPP_LOCAL sortedAsync(const std::string& objectId, const std::string *ss,
+                                SliceCB& slicecb, const UPnPDirProjection *proj,
+                                const std::string& sortcrit, std::atomic<bool>& cancel);
+    void UPNPP_LOCAL prefetchChildren(const UPnPDirContent& dirbuf, size_t first,
+                                      const UPnPDirProjection *proj);
 
     void UPNPP_LOCAL
         evtCallback(const std::unordered_map<std::string, std::string>&);
@@ -0,0 +1,319 @@
+/* Copyright (C) 2024 J.F.Dockes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301 USA
+ */
+#include "config.h"
+
+#include "libupnpp/control/cdirfedsearch.hxx"
+
+#include <upnp.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "libupnpp/log.hxx"
+#include "libupnpp/smallut.h"
+
+using namespace std;
+
+namespace UPnPClient {
+
+// Default duplicate detection key: same kind of object with the same main fields.
+static string defaultDedupKey(const UPnPDirObject& obj)
+{
+    string key(obj.m_type == UPnPDirObject::container ? "C" : "I");
+    key += stringtolower(obj.getprop("upnp:class"));
+    key += '\0';
+    key += stringtolower(obj.m_title);
+    key += '\0';
+    key += stringtolower(obj.getprop("upnp:artist"));
+    key += '\0';
+    key += stringtolower(obj.getprop("upnp:album"));
+    if (!obj.m_resources.empty()) {
+        key += '\0';
+        string duration;
+        obj.getrprop(0, "duration", duration);
+        key += duration;
+    }
+    return key;
+}
+
+class CDFederatedSearch::Internal {
+public:
+    struct Server {
+        CDSH cds;
+        std::shared_ptr<ContentDirectory::AsyncRead> op;
+        bool done{false};
+        int status{UPNP_E_SUCCESS};
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    string search;
+    bool hasproj{false};
+    UPnPDirProjection proj;
+    int deadlinems{5000};
+    DedupKeyFunc dedupkey{defaultDedupKey};
+    ResultCB resultcb;
+    ServerDoneCB donecb;
+
+    std::mutex mtx;
+    std::condition_variable cond;
+    // Serializes the client callbacks. Recursive because a callback may call cancel().
+    std::recursive_mutex cbmtx;
+    bool started{false};
+    bool stopping{false};
+    vector<Server> servers;
+    // Servers for which the done callback was not called yet
+    int pending{0};
+    int nok{0};
+    unordered_set<string> seen;
+    UPnPDirContent merged;
+    std::thread watchdog;
+
+    // Keep the new entries from a slice, and deliver them.
+    bool onSlice(size_t idx, UPnPDirContent& slice) {
+        UPnPDirContent fresh;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            if (servers[idx].done) {
+                return false;
+            }
+            auto dedup = [this](vector<UPnPDirObject>& in, vector<UPnPDirObject>& out,
+                                vector<UPnPDirObject>& all) {
+                for (auto& obj : in) {
+                    if (seen.insert(dedupkey(obj)).second) {
+                        all.push_back(obj);
+                        out.push_back(std::move(obj));
+                    }
+                }
+            };
+            dedup(slice.m_containers, fresh.m_containers, merged.m_containers);
+            dedup(slice.m_items, fresh.m_items, merged.m_items);
+        }
+        if (fresh.m_containers.empty() && fresh.m_items.empty()) {
+            return true;
+        }
+        bool ok;
+        {
+            std::unique_lock<std::recursive_mutex> cblock(cbmtx);
+            ok = resultcb(servers[idx].cds, fresh);
+        }
+        if (!ok) {
+            stopAll(UPNP_E_CANCELED);
+        }
+        return ok;
+    }
+
+    // Mark a server done, unless it already is, and call the client. The operation is
+    // cancelled in case it is still running.
+    void finish(size_t idx, int status) {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            Server& server = servers[idx];
+            if (server.done) {
+                return;
+            }
+            server.done = true;
+            server.status = status;
+            if (server.op) {
+                server.op->cancel();
+            }
+        }
+        LOGDEB("CDFederatedSearch: " << servers[idx].cds->getFriendlyName() << " status " <<
+               status << "\n");
+        if (donecb) {
+            std::unique_lock<std::recursive_mutex> cblock(cbmtx);
+            donecb(servers[idx].cds, status);
+        }
+        std::unique_lock<std::mutex> lock(mtx);
+        pending--;
+        if (status == UPNP_E_SUCCESS) {
+            nok++;
+        }
+        cond.notify_all();
+    }
+
+    void stopAll(int status) {
+        for (size_t idx = 0; idx < servers.size(); idx++) {
+            finish(idx, status);
+        }
+    }
+
+    // Time out the servers which did not complete before their deadline.
+    void runWatchdog() {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (!stopping && pending > 0) {
+            auto now = std::chrono::steady_clock::now();
+            auto next = std::chrono::steady_clock::time_point::max();
+            vector<size_t> expired;
+            for (size_t idx = 0; idx < servers.size(); idx++) {
+                const Server& server = servers[idx];
+                if (server.done)
+                    continue;
+                if (server.deadline <= now) {
+                    expired.push_back(idx);
+                } else if (server.deadline < next) {
+                    next = server.deadline;
+                }
+            }
+            if (!expired.empty()) {
+                lock.unlock();
+                for (auto idx : expired) {
+                    finish(idx, UPNP_E_TIMEDOUT);
+                }
+                lock.lock();
+                continue;
+            }
+            if (next == std::chrono::steady_clock::time_point::max()) {
+                cond.wait(lock);
+            } else {
+                cond.wait_until(lock, next);
+            }
+        }
+    }
+};
+
+CDFederatedSearch::CDFederatedSearch(const string& searchstring, const UPnPDirProjection *proj)
+    : m(std::make_shared<Internal>())
+{
+    m->search = searchstring;
+    if (proj) {
+        m->hasproj = true;
+        m->proj = *proj;
+    }
+}
+
+CDFederatedSearch::~CDFederatedSearch()
+{
+    cancel();
+    {
+        std::unique_lock<std::mutex> lock(m->mtx);
+        m->stopping = true;
+        m->cond.notify_all();
+    }
+    if (m->watchdog.joinable()) {
+        if (m->watchdog.get_id() == std::this_thread::get_id()) {
+            m->watchdog.detach();
+        } else {
+            m->watchdog.join();
+        }
+    }
+    // Deleting the operations waits for their threads.
+    vector<std::shared_ptr<ContentDirectory::AsyncRead>> ops;
+    {
+        std::unique_lock<std::mutex> lock(m->mtx);
+        for (auto& server : m->servers) {
+            ops.push_back(std::move(server.op));
+        }
+    }
+}
+
+void CDFederatedSearch::setDeadline(int ms)
+{
+    m->deadlinems = ms > 0 ? ms : 0;
+}
+
+void CDFederatedSearch::setDedupKey(DedupKeyFunc func)
+{
+    if (func) {
+        m->dedupkey = func;
+    }
+}
+
+bool CDFederatedSearch::start(ResultCB resultcb, ServerDoneCB donecb,
+                              const vector<CDSH> *servers)
+{
+    if (m->started || !resultcb) {
+        return false;
+    }
+    vector<CDSH> found;
+    if (nullptr == servers) {
+        ContentDirectory::getServices(found);
+        servers = &found;
+    }
+    if (servers->empty()) {
+        return false;
+    }
+    m->started = true;
+    m->resultcb = resultcb;
+    m->donecb = donecb;
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(m->deadlinems);
+    for (const auto& cds : *servers) {
+        Internal::Server server;
+        server.cds = cds;
+        server.deadline = deadline;
+        m->servers.push_back(std::move(server));
+    }
+    m->pending = static_cast<int>(m->servers.size());
+    LOGDEB("CDFederatedSearch::start: [" << m->search << "] on " << m->pending <<
+           " servers\n");
+
+    auto ip = m;
+    if (m->deadlinems > 0) {
+        m->watchdog = std::thread([ip] () {ip->runWatchdog();});
+    }
+    const UPnPDirProjection *proj = m->hasproj ? &m->proj : nullptr;
+    for (size_t idx = 0; idx < m->servers.size(); idx++) {
+        auto op = m->servers[idx].cds->searchAsync(
+            "0", m->search,
+            [ip, idx] (UPnPDirContent& slice, int, int) {
+                return ip->onSlice(idx, slice);
+            },
+            [ip, idx] (int status) {
+                ip->finish(idx, status);
+            },
+            proj);
+        std::unique_lock<std::mutex> lock(m->mtx);
+        m->servers[idx].op = op;
+        if (m->servers[idx].done) {
+            op->cancel();
+        }
+    }
+    return true;
+}
+
+void CDFederatedSearch::cancel()
+{
+    m->stopAll(UPNP_E_CANCELED);
+}
+
+bool CDFederatedSearch::isDone()
+{
+    std::unique_lock<std::mutex> lock(m->mtx);
+    return m->pending == 0;
+}
+
+int CDFederatedSearch::wait()
+{
+    std::unique_lock<std::mutex> lock(m->mtx);
+    m->cond.wait(lock, [this] {return m->pending == 0;});
+    return m->nok;
+}
+
+void CDFederatedSearch::getResults(UPnPDirContent& results)
+{
+    std::unique_lock<std::mutex> lock(m->mtx);
+    results = m->merged;
+}
+
+} // namespace UPnPClient
@@ -0,0 +1,105 @@
+/* Copyright (C) 2024 J.F.Dockes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301 USA
+ */
+#ifndef _CDIRFEDSEARCH_HXX_INCLUDED_
+#define _CDIRFEDSEARCH_HXX_INCLUDED_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "libupnpp/control/cdircontent.hxx"
+#include "libupnpp/control/cdirectory.hxx"
+
+namespace UPnPClient {
+
+/**
+ * Run the same search on several Content Directory servers at once (by default all the ones
+ * returned by ContentDirectory::getServices()), and merge the results.
+ *
+ * The results are delivered as each server returns them, without waiting for the others. An
+ * object which was already delivered, from the same or from another server, is not delivered
+ * again: the default duplicate detection uses the object type and class, title, artist and
+ * album, and the duration of the first resource, compared without case. It can be replaced by
+ * setDedupKey(). Each server has a deadline, after which its results are ignored, so that a
+ * slow or dead server does not hold the whole search.
+ *
+ * The callbacks are called from internal threads, one at a time.
+ */
+class UPNPP_API CDFederatedSearch {
+public:
+    /**
+     * @param searchstring the search criteria, see ContentDirectory::search()
+     * @param proj optional projection for the results (copied).
+     */
+    CDFederatedSearch(const std::string& searchstring,
+                      const UPnPDirProjection *proj = nullptr);
+    /** Cancel the search if it is still running. This may have to wait for the requests in
+     * progress to complete. Must not be called from one of the callbacks. */
+    ~CDFederatedSearch();
+    CDFederatedSearch(const CDFederatedSearch&) = delete;
+    CDFederatedSearch& operator=(const CDFederatedSearch&) = delete;
+
+    /** Called with each batch of new results from a server. The entries can be moved out of
+     * @param results. Return false to stop the whole search. */
+    typedef std::function<bool (const CDSH& server, UPnPDirContent& results)> ResultCB;
+    /** Called once for each server when it is done.
+     * @param status UPNP_E_SUCCESS, an error code, UPNP_E_TIMEDOUT if the deadline expired,
+     *    or UPNP_E_CANCELED if the search was stopped. */
+    typedef std::function<void (const CDSH& server, int status)> ServerDoneCB;
+    /** Compute the key used to detect duplicate results */
+    typedef std::function<std::string (const UPnPDirObject&)> DedupKeyFunc;
+
+    /** Set the per-server deadline in milliseconds (default 5000). 0 for none. Must be called
+     * before start(). */
+    void setDeadline(int ms);
+
+    /** Replace the duplicate detection key. Must be called before start(). */
+    void setDedupKey(DedupKeyFunc func);
+
+    /** Start the search.
+     *
+     * @param resultcb called for each batch of new results.
+     * @param donecb optional, called when each server is done.
+     * @param servers the servers to search. If null, use ContentDirectory::getServices().
+     * @return false if there is no server to search, or if start() was already called.
+     */
+    bool start(ResultCB resultcb, ServerDoneCB donecb = ServerDoneCB(),
+               const std::vector<CDSH> *servers = nullptr);
+
+    /** Stop the search. The pending servers are reported as UPNP_E_CANCELED. */
+    void cancel();
+
+    /** Check if all the servers are done */
+    bool isDone();
+
+    /** Wait until all the servers are done.
+     * @return the number of servers which completed successfully. */
+    int wait();
+
+    /** Get a copy of the merged results received up to now */
+    void getResults(UPnPDirContent& results);
+
+private:
+    class UPNPP_LOCAL Internal;
+    std::shared_ptr<Internal> m;
+};
+
+} // namespace UPnPClient
+
+#endif /* _CDIRFEDSEARCH_HXX_INCLUDED_ */
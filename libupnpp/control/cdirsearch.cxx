@@ -0,0 +1,676 @@
+/* Copyright (C) 2024 J.F.Dockes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301 USA
+ */
+#include "config.h"
+
+#include "libupnpp/control/cdirsearch.hxx"
+
+#include <upnp.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "libupnpp/control/cdircrawler.hxx"
+#include "libupnpp/log.hxx"
+#include "libupnpp/smallut.h"
+
+using namespace std;
+using namespace UPnPP;
+
+namespace UPnPClient {
+
+enum SearchOp {SOP_EQ, SOP_NE, SOP_LT, SOP_LE, SOP_GT, SOP_GE, SOP_CONTAINS,
+    SOP_NOTCONTAINS, SOP_DERIVED, SOP_EXISTS};
+
+// Parsed criteria node.
+struct SearchNode {
+    enum Type {SNT_ALL, SNT_AND, SNT_OR, SNT_REL};
+    Type type{SNT_ALL};
+    // SNT_AND, SNT_OR
+    vector<SearchNode> children;
+    // SNT_REL
+    string prop;
+    // Resource attribute name if prop is "res@xxx"
+    string resattr;
+    SearchOp op{SOP_EQ};
+    // Lowercased value
+    string value;
+    // For exists
+    bool boolval{false};
+    // Integer value for the ordering operators, if value is one
+    bool isnum{false};
+    int64_t numval{0};
+};
+
+static bool toInt64(const string& s, int64_t *val)
+{
+    if (s.empty()) {
+        return false;
+    }
+    char *endp;
+    errno = 0;
+    long long v = strtoll(s.c_str(), &endp, 10);
+    if (errno || *endp != 0) {
+        return false;
+    }
+    *val = v;
+    return true;
+}
+
+// Call func for each value of the property in the object, stopping if it returns true.
+// Returns true if func did, false if it did not or if the property is absent. *exists is set
+// if there was at least one value.
+static bool anyValue(const UPnPDirObject& obj, const SearchNode& node, bool *exists,
+                     const function<bool (const string&)>& func)
+{
+    *exists = false;
+    if (node.prop == "dc:title") {
+        *exists = true;
+        return func(obj.m_title);
+    } else if (node.prop == "@id") {
+        *exists = true;
+        return func(obj.m_id);
+    } else if (node.prop == "@parentID") {
+        *exists = true;
+        return func(obj.m_pid);
+    } else if (node.prop == "res") {
+        for (const auto& res : obj.m_resources) {
+            *exists = true;
+            if (func(res.m_uri))
+                return true;
+        }
+        return false;
+    } else if (!node.resattr.empty()) {
+        for (const auto& res : obj.m_resources) {
+            auto it = res.m_props.find(node.resattr);
+            if (it != res.m_props.end()) {
+                *exists = true;
+                if (func(it->second))
+                    return true;
+            }
+        }
+        return false;
+    }
+    if (obj.m_allprops) {
+        auto it = obj.m_allprops->find(node.prop);
+        if (it != obj.m_allprops->end()) {
+            for (const auto& pv : it->second) {
+                *exists = true;
+                if (func(pv.value))
+                    return true;
+            }
+            return false;
+        }
+    }
+    auto it = obj.m_props.find(node.prop);
+    if (it == obj.m_props.end()) {
+        return false;
+    }
+    *exists = true;
+    return func(it->second);
+}
+
+// Test a lowercased class name against a derivedfrom value: "object.item" matches itself and
+// "object.item.audioItem", not "object.items".
+static bool classDerived(const string& lclass, const string& base)
+{
+    return lclass.compare(0, base.size(), base) == 0 &&
+        (lclass.size() == base.size() || lclass[base.size()] == '.');
+}
+
+static bool testValue(const SearchNode& node, const string& value)
+{
+    string lval = stringtolower(value);
+    switch (node.op) {
+    case SOP_EQ:
+    case SOP_NE:
+        return lval == node.value;
+    case SOP_CONTAINS:
+    case SOP_NOTCONTAINS:
+        return lval.find(node.value) != string::npos;
+    case SOP_DERIVED:
+        return classDerived(lval, node.value);
+    default:
+        break;
+    }
+    int cmp;
+    int64_t num;
+    if (node.isnum && toInt64(lval, &num)) {
+        cmp = num < node.numval ? -1 : (num > node.numval ? 1 : 0);
+    } else {
+        cmp = lval.compare(node.value);
+    }
+    switch (node.op) {
+    case SOP_LT: return cmp < 0;
+    case SOP_LE: return cmp <= 0;
+    case SOP_GT: return cmp > 0;
+    case SOP_GE: return cmp >= 0;
+    default: return false;
+    }
+}
+
+static bool evalNode(const SearchNode& node, const UPnPDirObject& obj)
+{
+    switch (node.type) {
+    case SearchNode::SNT_ALL:
+        return true;
+    case SearchNode::SNT_AND:
+        for (const auto& child : node.children) {
+            if (!evalNode(child, obj))
+                return false;
+        }
+        return true;
+    case SearchNode::SNT_OR:
+        for (const auto& child : node.children) {
+            if (evalNode(child, obj))
+                return true;
+        }
+        return false;
+    case SearchNode::SNT_REL:
+        break;
+    }
+
+    bool exists;
+    if (node.op == SOP_EXISTS) {
+        anyValue(obj, node, &exists, [](const string&) {return true;});
+        return exists == node.boolval;
+    }
+    bool found = anyValue(obj, node, &exists,
+                          [&node](const string& v) {return testValue(node, v);});
+    if (node.op == SOP_NE || node.op == SOP_NOTCONTAINS) {
+        return exists && !found;
+    }
+    return found;
+}
+
+// Recursive descent parser for the SearchCriteria grammar.
+class SearchParser {
+public:
+    SearchParser(const string& input)
+        : m_in(input) {}
+
+    bool parse(SearchNode& root, string& reason) {
+        nextToken();
+        if (m_tok == TK_END) {
+            root.type = SearchNode::SNT_ALL;
+            return true;
+        }
+        if (m_tok == TK_WORD && m_tokval == "*") {
+            nextToken();
+            if (m_tok != TK_END) {
+                return fail(reason, "unexpected data after *");
+            }
+            root.type = SearchNode::SNT_ALL;
+            return true;
+        }
+        if (!parseOr(root) || m_tok != TK_END) {
+            if (m_error.empty())
+                m_error = "unexpected data";
+            return fail(reason, m_error);
+        }
+        return true;
+    }
+
+private:
+    enum Token {TK_END, TK_LPAR, TK_RPAR, TK_OP, TK_WORD, TK_QUOTED, TK_ERROR};
+
+    bool fail(string& reason, const string& what) {
+        reason = what + " at offset " + lltodecstr(m_tokstart) + " in [" + m_in + "]";
+        return false;
+    }
+
+    void nextToken() {
+        while (m_pos < m_in.size() && isspace(static_cast<unsigned char>(m_in[m_pos])))
+            m_pos++;
+        m_tokstart = m_pos;
+        m_tokval.clear();
+        if (m_pos == m_in.size()) {
+            m_tok = TK_END;
+            return;
+        }
+        char c = m_in[m_pos];
+        if (c == '(' || c == ')') {
+            m_tok = c == '(' ? TK_LPAR : TK_RPAR;
+            m_pos++;
+        } else if (c == '"') {
+            m_tok = TK_ERROR;
+            for (m_pos++; m_pos < m_in.size(); m_pos++) {
+                c = m_in[m_pos];
+                if (c == '\\' && m_pos + 1 < m_in.size()) {
+                    m_tokval += m_in[++m_pos];
+                } else if (c == '"') {
+                    m_pos++;
+                    m_tok = TK_QUOTED;
+                    break;
+                } else {
+                    m_tokval += c;
+                }
+            }
+        } else if (c == '=' || c == '!' || c == '<' || c == '>') {
+            m_tok = TK_OP;
+            m_tokval += c;
+            m_pos++;
+            if (m_pos < m_in.size() && m_in[m_pos] == '=') {
+                m_tokval += '=';
+                m_pos++;
+            }
+            if (m_tokval == "!") {
+                m_tok = TK_ERROR;
+            }
+        } else {
+            m_tok = TK_WORD;
+            while (m_pos < m_in.size()) {
+                c = m_in[m_pos];
+                if (isspace(static_cast<unsigned char>(c)) || c == '(' || c == ')' ||
+                    c == '"' || c == '=' || c == '!' || c == '<' || c == '>')
+                    break;
+                m_tokval += c;
+                m_pos++;
+            }
+        }
+    }
+
+    bool isKeyword(const char *kw) const {
+        return m_tok == TK_WORD && stringicmp(m_tokval, kw) == 0;
+    }
+
+    // Parse a sequence of sub-expressions separated by a logical operator. A single
+    // sub-expression is stored directly in node.
+    bool parseSeq(SearchNode& node, const char *kw, SearchNode::Type type,
+                  bool (SearchParser::*sub)(SearchNode&)) {
+        SearchNode first;
+        if (!(this->*sub)(first))
+            return false;
+        if (!isKeyword(kw)) {
+            node = std::move(first);
+            return true;
+        }
+        node.type = type;
+        node.children.push_back(std::move(first));
+        while (isKeyword(kw)) {
+            nextToken();
+            SearchNode next;
+            if (!(this->*sub)(next))
+                return false;
+            node.children.push_back(std::move(next));
+        }
+        return true;
+    }
+
+    bool parseOr(SearchNode& node) {
+        return parseSeq(node, "or", SearchNode::SNT_OR, &SearchParser::parseAnd);
+    }
+
+    bool parseAnd(SearchNode& node) {
+        return parseSeq(node, "and", SearchNode::SNT_AND, &SearchParser::parsePrimary);
+    }
+
+    bool parsePrimary(SearchNode& node) {
+        if (m_tok == TK_LPAR) {
+            nextToken();
+            if (!parseOr(node))
+                return false;
+            if (m_tok != TK_RPAR) {
+                m_error = "missing )";
+                return false;
+            }
+            nextToken();
+            return true;
+        }
+        return parseRel(node);
+    }
+
+    bool parseRel(SearchNode& node) {
+        if (m_tok != TK_WORD) {
+            m_error = "property name expected";
+            return false;
+        }
+        node.type = SearchNode::SNT_REL;
+        node.prop = m_tokval;
+        if (node.prop.compare(0, 4, "res@") == 0) {
+            node.resattr = node.prop.substr(4);
+        }
+        nextToken();
+
+        if (m_tok == TK_OP) {
+            static const map<string, SearchOp> ops{
+                {"=", SOP_EQ}, {"!=", SOP_NE}, {"<", SOP_LT}, {"<=", SOP_LE},
+                {">", SOP_GT}, {">=", SOP_GE}};
+            auto it = ops.find(m_tokval);
+            if (it == ops.end()) {
+                m_error = "bad operator";
+                return false;
+            }
+            node.op = it->second;
+        } else if (isKeyword("contains")) {
+            node.op = SOP_CONTAINS;
+        } else if (isKeyword("doesNotContain")) {
+            node.op = SOP_NOTCONTAINS;
+        } else if (isKeyword("derivedfrom")) {
+            node.op = SOP_DERIVED;
+        } else if (isKeyword("exists")) {
+            node.op = SOP_EXISTS;
+        } else {
+            m_error = "operator expected";
+            return false;
+        }
+        nextToken();
+
+        if (node.op == SOP_EXISTS) {
+            if (isKeyword("true")) {
+                node.boolval = true;
+            } else if (isKeyword("false")) {
+                node.boolval = false;
+            } else {
+                m_error = "true or false expected";
+                return false;
+            }
+        } else {
+            // Be lenient and accept unquoted single words
+            if (m_tok != TK_QUOTED && m_tok != TK_WORD) {
+                m_error = "value expected";
+                return false;
+            }
+            node.value = m_tokval;
+            stringtolower(node.value);
+            node.isnum = toInt64(node.value, &node.numval);
+        }
+        nextToken();
+        return true;
+    }
+
+    const string& m_in;
+    string::size_type m_pos{0};
+    string::size_type m_tokstart{0};
+    Token m_tok{TK_END};
+    string m_tokval;
+    string m_error;
+};
+
+
+class UPnPSearchCriteria::Internal {
+public:
+    SearchNode root;
+    bool ok{true};
+    string reason;
+};
+
+UPnPSearchCriteria::UPnPSearchCriteria()
+    : m(std::make_shared<Internal>())
+{
+}
+
+UPnPSearchCriteria::UPnPSearchCriteria(const string& criteria)
+{
+    auto internal = std::make_shared<Internal>();
+    SearchParser parser(criteria);
+    internal->ok = parser.parse(internal->root, internal->reason);
+    if (!internal->ok) {
+        LOGINF("UPnPSearchCriteria: " << internal->reason << "\n");
+    }
+    m = internal;
+}
+
+bool UPnPSearchCriteria::ok() const
+{
+    return m->ok;
+}
+
+const string& UPnPSearchCriteria::error() const
+{
+    return m->reason;
+}
+
+bool UPnPSearchCriteria::match(const UPnPDirObject& obj) const
+{
+    return m->ok && evalNode(m->root, obj);
+}
+
+void UPnPSearchCriteria::filter(const UPnPDirContent& in, UPnPDirContent& out) const
+{
+    for (const auto& obj : in.m_containers) {
+        if (match(obj))
+            out.m_containers.push_back(obj);
+    }
+    for (const auto& obj : in.m_items) {
+        if (match(obj))
+            out.m_items.push_back(obj);
+    }
+}
+
+
+// Properties with an inverted index. The class index is also used for derivedfrom.
+static const vector<string> indexedprops{
+    "upnp:artist", "upnp:album", "upnp:genre", "upnp:class", "dc:creator"};
+
+class CDLocalIndex::Internal {
+public:
+    // Sorted object indexes
+    typedef vector<uint32_t> Postings;
+    // Lowercased value -> postings. Ordered for the derivedfrom prefix ranges.
+    typedef map<string, Postings> ValueIndex;
+
+    vector<UPnPDirObject> objects;
+    map<string, ValueIndex> indexes;
+
+    void indexObject(const UPnPDirObject& obj, uint32_t idx) {
+        for (const auto& prop : indexedprops) {
+            SearchNode node;
+            node.prop = prop;
+            bool exists;
+            ValueIndex& vindex = indexes[prop];
+            anyValue(obj, node, &exists, [&vindex, idx](const string& v) {
+                Postings& postings = vindex[stringtolower(v)];
+                // A multi-valued property may repeat a value
+                if (postings.empty() || postings.back() != idx)
+                    postings.push_back(idx);
+                return false;
+            });
+        }
+    }
+
+    static void unite(Postings& out, const Postings& in) {
+        Postings res;
+        res.reserve(out.size() + in.size());
+        std::set_union(out.begin(), out.end(), in.begin(), in.end(), back_inserter(res));
+        out.swap(res);
+    }
+
+    static void intersect(Postings& out, const Postings& in) {
+        Postings res;
+        std::set_intersection(out.begin(), out.end(), in.begin(), in.end(),
+                              back_inserter(res));
+        out.swap(res);
+    }
+
+    // Compute a superset of the matches for a node from the indexes. Returns false if the
+    // node can't be resolved from the indexes (every object is a candidate).
+    bool candidates(const SearchNode& node, Postings& out) const {
+        switch (node.type) {
+        case SearchNode::SNT_ALL:
+            return false;
+        case SearchNode::SNT_AND: {
+            bool found = false;
+            for (const auto& child : node.children) {
+                Postings cp;
+                if (!candidates(child, cp))
+                    continue;
+                if (found) {
+                    intersect(out, cp);
+                } else {
+                    out.swap(cp);
+                    found = true;
+                }
+                if (out.empty())
+                    break;
+            }
+            return found;
+        }
+        case SearchNode::SNT_OR:
+            for (const auto& child : node.children) {
+                Postings cp;
+                if (!candidates(child, cp))
+                    return false;
+                unite(out, cp);
+            }
+            return true;
+        case SearchNode::SNT_REL:
+            break;
+        }
+
+        auto iit = indexes.find(node.prop);
+        if (iit == indexes.end()) {
+            return false;
+        }
+        const ValueIndex& vindex = iit->second;
+        switch (node.op) {
+        case SOP_EQ: {
+            auto it = vindex.find(node.value);
+            if (it != vindex.end())
+                out = it->second;
+            return true;
+        }
+        case SOP_DERIVED:
+            for (auto it = vindex.lower_bound(node.value);
+                 it != vindex.end() && it->first.compare(0, node.value.size(), node.value) == 0;
+                 it++) {
+                if (classDerived(it->first, node.value))
+                    unite(out, it->second);
+            }
+            return true;
+        case SOP_CONTAINS:
+            // The distinct values are much fewer than the objects.
+            for (const auto& entry : vindex) {
+                if (entry.first.find(node.value) != string::npos)
+                    unite(out, entry.second);
+            }
+            return true;
+        case SOP_EXISTS:
+            if (!node.boolval)
+                return false;
+            for (const auto& entry : vindex) {
+                unite(out, entry.second);
+            }
+            return true;
+        default:
+            return false;
+        }
+    }
+};
+
+CDLocalIndex::CDLocalIndex()
+    : m(new Internal())
+{
+}
+
+CDLocalIndex::~CDLocalIndex()
+{
+    delete m;
+}
+
+void CDLocalIndex::add(const UPnPDirObject& obj)
+{
+    auto idx = static_cast<uint32_t>(m->objects.size());
+    m->objects.push_back(obj);
+    m->objects.back().releaseDidl();
+    m->indexObject(m->objects.back(), idx);
+}
+
+void CDLocalIndex::add(const UPnPDirContent& dir)
+{
+    for (const auto& obj : dir.m_containers) {
+        add(obj);
+    }
+    for (const auto& obj : dir.m_items) {
+        add(obj);
+    }
+}
+
+void CDLocalIndex::add(const CDCrawler& crawler)
+{
+    crawler.visit([this](const UPnPDirObject& obj) {
+        add(obj);
+        return true;
+    });
+}
+
+void CDLocalIndex::clear()
+{
+    m->objects.clear();
+    m->indexes.clear();
+}
+
+size_t CDLocalIndex::size() const
+{
+    return m->objects.size();
+}
+
+int CDLocalIndex::search(const UPnPSearchCriteria& criteria, UPnPDirContent& result,
+                         int offset, int count, int *total) const
+{
+    if (!criteria.ok()) {
+        return UPNP_E_INVALID_PARAM;
+    }
+    const SearchNode& root = criteria.m->root;
+    int nmatch = 0;
+    auto check = [&](uint32_t idx) {
+        const UPnPDirObject& obj = m->objects[idx];
+        if (!evalNode(root, obj))
+            return;
+        if (nmatch++ < offset || (count > 0 && nmatch > offset + count))
+            return;
+        if (obj.m_type == UPnPDirObject::container) {
+            result.m_containers.push_back(obj);
+        } else {
+            result.m_items.push_back(obj);
+        }
+    };
+
+    Internal::Postings cands;
+    if (m->candidates(root, cands)) {
+        LOGDEB1("CDLocalIndex::search: " << cands.size() << " candidates\n");
+        for (auto idx : cands) {
+            check(idx);
+        }
+    } else {
+        for (uint32_t idx = 0; idx < m->objects.size(); idx++) {
+            check(idx);
+        }
+    }
+    if (total) {
+        *total = nmatch;
+    }
+    return UPNP_E_SUCCESS;
+}
+
+int CDLocalIndex::search(const string& criteria, UPnPDirContent& result,
+                         int offset, int count, int *total) const
+{
+    return search(UPnPSearchCriteria(criteria), result, offset, count, total);
+}
+
+} // namespace UPnPClient
@@ -0,0 +1,128 @@
+/* Copyright (C) 2024 J.F.Dockes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301 USA
+ */
+#ifndef _CDIRSEARCH_HXX_INCLUDED_
+#define _CDIRSEARCH_HXX_INCLUDED_
+
+#include <memory>
+#include <string>
+
+#include "libupnpp/control/cdircontent.hxx"
+
+namespace UPnPClient {
+
+class CDCrawler;
+
+/**
+ * Compiled UPnP ContentDirectory SearchCriteria, for evaluating searches locally, e.g. on
+ * servers which do not support Search.
+ *
+ * The syntax is the one from the ContentDirectory specification: relational expressions
+ * (property op "value", with op one of =, !=, <, <=, >, >=, contains, doesNotContain,
+ * derivedfrom, or property exists true/false), combined with and/or (and binds tighter), and
+ * parentheses. "*" matches everything.
+ *
+ * Comparisons are case-insensitive. <, <=, > and >= compare numerically if both values are
+ * integers. Multi-valued properties (only distinguished if the objects were parsed with the
+ * detailed option) match if any value does, except for != and doesNotContain which match if
+ * no value does. Besides the element names, properties can be "@id", "@parentID", "res"
+ * (resource URIs) and "res@attr" (resource attributes).
+ *
+ * The object is cheap to copy and can be shared between threads.
+ */
+class UPNPP_API UPnPSearchCriteria {
+public:
+    /** Default: match everything */
+    UPnPSearchCriteria();
+
+    /** Compile criteria. Check ok() for syntax errors. */
+    explicit UPnPSearchCriteria(const std::string& criteria);
+
+    /** True if the criteria were successfully parsed */
+    bool ok() const;
+
+    /** Return the syntax error message, if ok() is false */
+    const std::string& error() const;
+
+    /** Test an object against the criteria. Always false if ok() is false. */
+    bool match(const UPnPDirObject& obj) const;
+
+    /** Add the entries of @param in which match the criteria to @param out */
+    void filter(const UPnPDirContent& in, UPnPDirContent& out) const;
+
+private:
+    friend class CDLocalIndex;
+    class UPNPP_LOCAL Internal;
+    std::shared_ptr<const Internal> m;
+};
+
+/**
+ * Local store of directory objects, with inverted indexes on common properties (upnp:artist,
+ * upnp:album, upnp:genre, upnp:class, dc:creator) for fast evaluation of search criteria.
+ *
+ * The index is used for the equality, contains and derivedfrom conditions on the indexed
+ * properties, combined with and/or. The candidates are then checked against the full
+ * criteria. Searches which can't use the index test every object.
+ *
+ * The object is not thread-safe for updates. Concurrent searches are ok.
+ */
+class UPNPP_API CDLocalIndex {
+public:
+    CDLocalIndex();
+    ~CDLocalIndex();
+    CDLocalIndex(const CDLocalIndex&) = delete;
+    CDLocalIndex& operator=(const CDLocalIndex&) = delete;
+
+    /** Add an object. No check is made for duplicates. */
+    void add(const UPnPDirObject& obj);
+
+    /** Add the containers and items from a directory listing */
+    void add(const UPnPDirContent& dir);
+
+    /** Add all the objects in a crawler index */
+    void add(const CDCrawler& crawler);
+
+    /** Forget everything */
+    void clear();
+
+    /** Number of stored objects */
+    size_t size() const;
+
+    /** Search the index.
+     *
+     * @param criteria the compiled search criteria.
+     * @param[out] result the matching objects are appended, in insertion order.
+     * @param offset number of matching objects to skip.
+     * @param count maximum number of objects to return, 0 for all.
+     * @param[out] total if not null, set to the total number of matches.
+     * @return UPNP_E_SUCCESS, or UPNP_E_INVALID_PARAM if the criteria are invalid.
+     */
+    int search(const UPnPSearchCriteria& criteria, UPnPDirContent& result,
+               int offset = 0, int count = 0, int *total = nullptr) const;
+
+    /** Same as above, compiling the criteria string. */
+    int search(const std::string& criteria, UPnPDirContent& result,
+               int offset = 0, int count = 0, int *total = nullptr) const;
+
+private:
+    class UPNPP_LOCAL Internal;
+    Internal *m;
+};
+
+} // namespace UPnPClient
+
+#endif /* _CDIRSEARCH_HXX_INCLUDED_ */
@@ -48,31 +48,53 @@ int ConnectionManager::getProtocolInfo(
 {
     sourceEntries.clear();
     sinkEntries.clear();
-    std::map<std::string, std::string> data;
-    int ret = runAction("GetProtocolInfo", std::vector<std::string>(), data);
+    SoapOutgoing args(getServiceType(), "GetProtocolInfo");
+    SoapIncoming data;
+    int ret = runCachedAction(args, data);
     if (ret != UPNP_E_SUCCESS) {
         return ret;
     }
-    auto it = data.find("Source");
-    if (it == data.end()) {
+    string value;
+    if (!data.get("Source", &value)) {
         LOGERR("ConnectionManager::getProtocolInfo: no Source data\n");
         return UPNP_E_BAD_RESPONSE;
     }
-    if (!parseProtocolInfo(it->second, sourceEntries)) {
+    if (!parseProtocolInfo(value, sourceEntries)) {
         LOGERR("ConnectionManager::getProtocolInfo: Source data parse failed\n");
         return UPNP_E_BAD_RESPONSE;
     }
-    it = data.find("Sink");
-    if (it == data.end()) {
+    if (!data.get("Sink", &value)) {
         LOGERR("ConnectionManager::getProtocolInfo: no Sink data\n");
         return UPNP_E_BAD_RESPONSE;
     }
-    if (!parseProtocolInfo(it->second, sinkEntries)) {
+    if (!parseProtocolInfo(value, sinkEntries)) {
         LOGERR("ConnectionManager::getProtocolInfo: Sink data parse failed\n");
         return UPNP_E_BAD_RESPONSE;
     }
     return UPNP_E_SUCCESS;
 }
 
+// Same as the TypedService callback, also keeping the cached protocol lists up to date.
+void ConnectionManager::evtCallback(const std::unordered_map<std::string, std::string>& props)
+{
+    VarEventReporter *reporter = getReporter();
+    for (const auto& [varnm, varvalue] : props) {
+        if (varnm == "SourceProtocolInfo") {
+            updateCachedAction("GetProtocolInfo", "Source", varvalue);
+        } else if (varnm == "SinkProtocolInfo") {
+            updateCachedAction("GetProtocolInfo", "Sink", varvalue);
+        }
+        if (!reporter) {
+            LOGDEB1("ConnectionManager::evtCallback: " << varnm << " -> " << varvalue << '\n');
+        } else {
+            reporter->changed(varnm.c_str(), varvalue.c_str());
+        }
+    }
+}
+
+void ConnectionManager::registerCallback()
+{
+    Service::registerCallback(bind(&ConnectionManager::evtCallback, this, _1));
+}
 
 } // namespace
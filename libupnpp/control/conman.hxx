@@ -32,11 +32,17 @@ public:
         : TypedService(tp) {
     }
 
+    /** Get the source and sink protocol lists. The values are only read once while the
+     * device is up, and updated from the events if a reporter is installed. */
     int getProtocolInfo(std::vector<UPnPP::ProtocolinfoEntry>& sourceEntries,
                         std::vector<UPnPP::ProtocolinfoEntry>& sinkEntries);
     
     static bool isConManService(const std::string& st);
     bool serviceTypeMatch(const std::string& tp) override;
+
+private:
+    void UPNPP_LOCAL evtCallback(const std::unordered_map<std::string, std::string>&);
+    void UPNPP_LOCAL registerCallback() override;
 };
     
 } // namespace
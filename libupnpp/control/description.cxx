@@ -27,6 +27,7 @@
 #include <upnp.h>
 
 #include "libupnpp/upnpplib.hxx"
+#include "libupnpp/cstrhash.hxx"
 #include "libupnpp/expatmm.h"
 #include "libupnpp/upnpp_p.hxx"
 #include "libupnpp/smallut.h"
@@ -37,10 +38,45 @@ using namespace UPnPP;
 
 namespace UPnPClient {
 
+// The device description tags we look at, dispatched on a compile-time hash of the name (see
+// cstrhash.hxx), then confirmed by a string comparison.
+enum DevTag {DEVT_OTHER, DEVT_SERVICE, DEVT_DEVICE, DEVT_CONTROLURL, DEVT_EVENTSUBURL,
+             DEVT_SERVICETYPE, DEVT_SERVICEID, DEVT_SCPDURL, DEVT_DEVICETYPE, DEVT_FRIENDLYNAME,
+             DEVT_MANUFACTURER, DEVT_MODELNAME, DEVT_UDN, DEVT_URLBASE};
+
+static DevTag devTag(const char *name)
+{
+    DevTag tag{DEVT_OTHER};
+    const char *ref{""};
+    switch (strhash(name)) {
+    case strhash("service"): tag = DEVT_SERVICE; ref = "service"; break;
+    case strhash("device"): tag = DEVT_DEVICE; ref = "device"; break;
+    case strhash("controlURL"): tag = DEVT_CONTROLURL; ref = "controlURL"; break;
+    case strhash("eventSubURL"): tag = DEVT_EVENTSUBURL; ref = "eventSubURL"; break;
+    case strhash("serviceType"): tag = DEVT_SERVICETYPE; ref = "serviceType"; break;
+    case strhash("serviceId"): tag = DEVT_SERVICEID; ref = "serviceId"; break;
+    case strhash("SCPDURL"): tag = DEVT_SCPDURL; ref = "SCPDURL"; break;
+    case strhash("deviceType"): tag = DEVT_DEVICETYPE; ref = "deviceType"; break;
+    case strhash("friendlyName"): tag = DEVT_FRIENDLYNAME; ref = "friendlyName"; break;
+    case strhash("manufacturer"): tag = DEVT_MANUFACTURER; ref = "manufacturer"; break;
+    case strhash("modelName"): tag = DEVT_MODELNAME; ref = "modelName"; break;
+    case strhash("UDN"): tag = DEVT_UDN; ref = "UDN"; break;
+    case strhash("URLBase"): tag = DEVT_URLBASE; ref = "URLBase"; break;
+    default: break;
+    }
+    return strcmp(name, ref) ? DEVT_OTHER : tag;
+}
+
 class UPnPDeviceParser : public inputRefXMLParser {
 public:
-    UPnPDeviceParser(const string& input, UPnPDeviceDesc& device)
-        : inputRefXMLParser(input), m_device(device) {}
+    UPnPDeviceParser(const string& input, UPnPDeviceDesc& device, bool headeronly = false)
+        : inputRefXMLParser(input), m_device(device), m_headeronly(headeronly) {}
+
+    // In header-only mode, we stop the parser as soon as we have the main device identification
+    // fields. Parse() then returns false, but this is not an error.
+    bool stoppedEarly() const {
+        return m_stopped;
+    }
 
 protected:
     void EndElement(const XML_Char* name) override
@@ -58,39 +94,41 @@ protected:
 
         UPnPDeviceDesc* dev = ismain ? &m_device : &m_tdevice;
 
-        if (!strcmp(name, "service")) {
-            dev->services.push_back(m_tservice);
+        switch (devTag(name)) {
+        case DEVT_SERVICE:
+            if (!m_headeronly) {
+                dev->services.push_back(m_tservice);
+            }
             m_tservice.clear();
-        } else if (!strcmp(name, "device")) {
-            if (!ismain) {
+            break;
+        case DEVT_DEVICE:
+            if (!ismain && !m_headeronly) {
                 m_device.embedded.push_back(m_tdevice);
             }
             m_tdevice.clear();
-        } else if (!strcmp(name, "controlURL")) {
-            m_tservice.controlURL = m_chardata;
-        } else if (!strcmp(name, "eventSubURL")) {
-            m_tservice.eventSubURL = m_chardata;
-        } else if (!strcmp(name, "serviceType")) {
-            m_tservice.serviceType = m_chardata;
-        } else if (!strcmp(name, "serviceId")) {
-            m_tservice.serviceId = m_chardata;
-        } else if (!strcmp(name, "SCPDURL")) {
-            m_tservice.SCPDURL = m_chardata;
-        } else if (!strcmp(name, "deviceType")) {
-            dev->deviceType = m_chardata;
-        } else if (!strcmp(name, "friendlyName")) {
-            dev->friendlyName = m_chardata;
-        } else if (!strcmp(name, "manufacturer")) {
-            dev->manufacturer = m_chardata;
-        } else if (!strcmp(name, "modelName")) {
-            dev->modelName = m_chardata;
-        } else if (!strcmp(name, "UDN")) {
-            dev->UDN = m_chardata;
-        } else if (!strcmp(name, "URLBase")) {
-            m_device.URLBase = m_chardata;
+            break;
+        case DEVT_CONTROLURL: m_tservice.controlURL = m_chardata; break;
+        case DEVT_EVENTSUBURL: m_tservice.eventSubURL = m_chardata; break;
+        case DEVT_SERVICETYPE: m_tservice.serviceType = m_chardata; break;
+        case DEVT_SERVICEID: m_tservice.serviceId = m_chardata; break;
+        case DEVT_SCPDURL: m_tservice.SCPDURL = m_chardata; break;
+        case DEVT_DEVICETYPE: dev->deviceType = m_chardata; break;
+        case DEVT_FRIENDLYNAME: dev->friendlyName = m_chardata; break;
+        case DEVT_MANUFACTURER: dev->manufacturer = m_chardata; break;
+        case DEVT_MODELNAME: dev->modelName = m_chardata; break;
+        case DEVT_UDN: dev->UDN = m_chardata; break;
+        case DEVT_URLBASE: m_device.URLBase = m_chardata; break;
+        default: break;
         }
 
         m_chardata.clear();
+
+        if (m_headeronly && ismain && !m_device.deviceType.empty() &&
+            !m_device.friendlyName.empty() && !m_device.UDN.empty() &&
+            !m_device.manufacturer.empty() && !m_device.modelName.empty()) {
+            m_stopped = true;
+            XML_StopParser(expat_parser, XML_FALSE);
+        }
     }
 
     void CharacterData(const XML_Char* s, int len) override
@@ -104,19 +142,26 @@ protected:
 
 private:
     UPnPDeviceDesc& m_device;
+    bool m_headeronly;
+    bool m_stopped{false};
     string m_chardata;
     UPnPServiceDesc m_tservice;
     UPnPDeviceDesc m_tdevice;
 };
 
 UPnPDeviceDesc::UPnPDeviceDesc(const string& url, const string& description)
+    : UPnPDeviceDesc(url, description, false)
+{
+}
+
+UPnPDeviceDesc::UPnPDeviceDesc(const string& url, const string& description, bool headeronly)
     : XMLText(description)
 {
     //cerr << "UPnPDeviceDesc::UPnPDeviceDesc: url: " << url << endl;
     //cerr << " description " << endl << description << endl;
 
-    UPnPDeviceParser mparser(description, *this);
-    if (!mparser.Parse())
+    UPnPDeviceParser mparser(description, *this, headeronly);
+    if (!mparser.Parse() && !mparser.stoppedEarly())
         return;
     descURL = url;
     if (URLBase.empty()) {
@@ -127,9 +172,13 @@ UPnPDeviceDesc::UPnPDeviceDesc(const string& url, const string& description)
         // (rare, but e.g. sent by the server on a dlink nas).
         URLBase = baseurl(url);
     }
-    for (auto& dev: embedded) {
-        dev.URLBase = URLBase;
-        dev.ok = true;
+    if (headeronly) {
+        m_fullyparsed = false;
+    } else {
+        for (auto& dev: embedded) {
+            dev.URLBase = URLBase;
+            dev.ok = true;
+        }
     }
     
     ok = true;
@@ -137,6 +186,38 @@ UPnPDeviceDesc::UPnPDeviceDesc(const string& url, const string& description)
     //cerr << dump() << endl;
 }
 
+bool UPnPDeviceDesc::parseFull()
+{
+    if (m_fullyparsed) {
+        return ok;
+    }
+    if (m_parsefailed) {
+        return false;
+    }
+    // Parse into a temporary so that a failure leaves us unchanged (still usable for the header
+    // fields).
+    UPnPDeviceDesc tmp;
+    UPnPDeviceParser mparser(XMLText, tmp);
+    if (!mparser.Parse()) {
+        LOGERR("UPnPDeviceDesc::parseFull: parse failed for " << descURL << " : " <<
+               mparser.getLastErrorMessage() << '\n');
+        m_parsefailed = true;
+        return false;
+    }
+    // The URLBase element may come after the root device, where the header-only parse stopped.
+    if (!tmp.URLBase.empty()) {
+        URLBase = tmp.URLBase;
+    }
+    services.swap(tmp.services);
+    embedded.swap(tmp.embedded);
+    for (auto& dev: embedded) {
+        dev.URLBase = URLBase;
+        dev.ok = true;
+    }
+    m_fullyparsed = true;
+    return true;
+}
+
 
 // XML parser for the service description document (SCPDURL)
 class ServiceDescriptionParser : public inputRefXMLParser {
@@ -206,10 +287,10 @@ protected:
         case 'm':
             if (!strcmp(name, "minimum")) {
                 m_tvar.hasValueRange = true;
-                m_tvar.minimum = atoi(lastelt.data.c_str());
+                m_tvar.minimum = stringToInt(lastelt.data);
             } else if (!strcmp(name, "maximum")) {
                 m_tvar.hasValueRange = true;
-                m_tvar.maximum = atoi(lastelt.data.c_str());
+                m_tvar.maximum = stringToInt(lastelt.data);
             }
             break;
         case 'n':
@@ -237,7 +318,7 @@ protected:
                 m_parsed.stateTable[m_tvar.name] = m_tvar;
             } else if (!strcmp(name, "step")) {
                 m_tvar.hasValueRange = true;
-                m_tvar.step = atoi(lastelt.data.c_str());
+                m_tvar.step = stringToInt(lastelt.data);
             }
             break;
         }
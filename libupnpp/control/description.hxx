@@ -147,8 +147,29 @@ public:
      */
     UPnPDeviceDesc(const std::string& url, const std::string& description);
 
+    /** Build device from the XML description, possibly in two phases. 
+     * If @param headeronly is true, only the main device identification fields (deviceType,
+     * friendlyName, UDN, URLBase, manufacturer, modelName) are extracted, and the services and
+     * embedded device lists are left empty until parseFull() is called. This is used by the
+     * discovery module to avoid building the full tree for devices which are only listed.
+     */
+    UPnPDeviceDesc(const std::string& url, const std::string& description, bool headeronly);
+
     UPnPDeviceDesc() = default;
 
+    /** Return true if the services and embedded device lists are populated. This is always
+     * the case except for an object built in header-only mode and not yet completed. */
+    bool fullyParsed() const {
+        return m_fullyparsed;
+    }
+
+    /** Parse the services and embedded device lists if this was not done yet. This modifies
+     * the object, so callers sharing it between threads must lock it. A failure is remembered:
+     * the data is not parsed again by the next calls.
+     * @return false if the XML data could not be parsed. 
+     */
+    bool parseFull();
+
     /// Parse success status.
     bool ok{false};
     /// Device Type: e.g. urn:schemas-upnp-org:device:MediaServer:1
@@ -189,6 +210,9 @@ public:
         std::ostringstream os;
         os << "DEVICE " << " {deviceType [" << deviceType << "] friendlyName [" << friendlyName <<
             "] UDN [" << UDN << "] URLBase [" << URLBase << "] Services:" << '\n';
+        if (!m_fullyparsed) {
+            os << "    (not parsed yet)" << '\n';
+        }
         for (const auto& service : services) {
             os << "    " << service.dump();
         }
@@ -198,6 +222,10 @@ public:
         os << "}" << '\n';
         return os.str();
     }
+
+private:
+    bool m_fullyparsed{true};
+    bool m_parsefailed{false};
 };
 
 } // namespace
@@ -24,6 +24,10 @@
 #include <upnp.h>
 #include <netif.h>
 
+#ifndef _WIN32
+#include <netinet/in.h>
+#endif
+
 #include <unordered_set>
 #include <map>
 #include <utility>
@@ -36,6 +40,7 @@
 #include "libupnpp/upnpputils.hxx"
 #include "libupnpp/workqueue.h"
 #include "libupnpp/control/httpdownload.hxx"
+#include "libupnpp/control/soapclient.hxx"
 #include "libupnpp/control/description.hxx"
 #include "libupnpp/control/discovery.hxx"
 
@@ -74,7 +79,7 @@ static bool search();
 // This is called by the thread which processes the device events
 // when a new device appears. It wakes up any thread waiting for a
 // device.
-static bool deviceFound(const UPnPDeviceDesc&, const UPnPServiceDesc&);
+static void deviceFound();
 static void expireDevices();
 
 static string cluDiscoveryToStr(const UpnpDiscovery *disco)
@@ -193,6 +198,13 @@ static int cluCallBack(Upnp_EventType et, CBCONST void* evp, void*)
         }
         LOGDEB1("discovery:cllb: downloaded description document of " <<
                 tp->description.size() << " bytes" << '\n');
+        if (disco->DestAddr.ss_family == AF_INET6) {
+            // Needed for the actions sent by soapSendAction() to a link-local address.
+            struct sockaddr_in6 *sa6p = (struct sockaddr_in6 *)&disco->DestAddr;
+            if (sa6p->sin6_scope_id != 0) {
+                soapSetScopeId(tp->url, (long)sa6p->sin6_scope_id);
+            }
+        }
 
         {   std::unique_lock<std::mutex> lock(o_downloading_mutex);
             o_downloading.erase(tp->url);
@@ -231,7 +243,7 @@ static vector<UPnPDeviceDirectory::Visitor> o_callbacks;
 static vector<UPnPDeviceDirectory::Visitor> o_lostCallbacks;
 static std::mutex o_callbacks_mutex;
 static bool simpleTraverse(UPnPDeviceDirectory::Visitor visit);
-static bool simpleVisit(const UPnPDeviceDesc&, UPnPDeviceDirectory::Visitor);
+static bool simpleVisit(UPnPDeviceDesc&, UPnPDeviceDirectory::Visitor);
 
 unsigned int UPnPDeviceDirectory::addCallback(UPnPDeviceDirectory::Visitor v)
 {
@@ -272,9 +284,12 @@ void UPnPDeviceDirectory::delLostCallback(unsigned int idx)
 // Descriptor kept in the device pool for each device found on the network.
 class DeviceDescriptor {
 public:
+    // The device description is only parsed for the main identification fields at this point.
+    // The services and embedded devices lists are parsed when first needed (visiting or copying
+    // out the entry), which may be never for a device which is only listed.
     DeviceDescriptor(const string& url, const string& description,
                      std::chrono::steady_clock::time_point last, int exp)
-        : device(url, description), last_seen(last), expires(std::chrono::seconds(exp)) {}
+        : device(url, description, true), last_seen(last), expires(std::chrono::seconds(exp)) {}
     DeviceDescriptor() = default;
     UPnPDeviceDesc device;
     std::chrono::steady_clock::time_point last_seen;
@@ -347,15 +362,33 @@ static void *discoExplorer(void *)
                 std::unique_lock<std::mutex> lock(o_pool.m_mutex);
                 LOGDEB1("discoExplorer: inserting device id "<< tsk->deviceId
                         << " description: " << '\n' << d.device.dump() << '\n');
-                o_pool.m_devices[tsk->deviceId] = d;
+                auto it = o_pool.m_devices.find(tsk->deviceId);
+                if (it != o_pool.m_devices.end() && it->second.device.XMLText == d.device.XMLText) {
+                    // Same description as before: keep the possibly already fully parsed data.
+                    it->second.last_seen = d.last_seen;
+                    it->second.expires = d.expires;
+                } else {
+                    o_pool.m_devices[tsk->deviceId] = d;
+                }
             }
+            deviceFound();
 
             {
+                // simpleVisit() parses the services of our copy if there are callbacks.
                 std::unique_lock<std::mutex> lock(o_callbacks_mutex);
                 for (auto& cbp : o_callbacks) {
                     simpleVisit(d.device, cbp);
                 }
             }
+            if (d.device.fullyParsed()) {
+                // Don't parse again for the pool entry if it is still the same.
+                std::unique_lock<std::mutex> lock(o_pool.m_mutex);
+                auto it = o_pool.m_devices.find(tsk->deviceId);
+                if (it != o_pool.m_devices.end() && !it->second.device.fullyParsed() &&
+                    it->second.device.XMLText == d.device.XMLText) {
+                    it->second.device = d.device;
+                }
+            }
         }
         delete tsk;
     }
@@ -411,8 +444,6 @@ UPnPDeviceDirectory::UPnPDeviceDirectory(time_t search_window)
 
     o_searchTimeout = search_window;
 
-    addCallback(std::bind(&deviceFound, _1, _2));
-
     if (!discoveredQueue.start(1, discoExplorer, 0)) {
         o_reason = "Discover work queue start failed";
         return;
@@ -537,9 +568,11 @@ time_t UPnPDeviceDirectory::getRemainingDelay()
 static std::mutex devWaitLock;
 static std::condition_variable devWaitCond;
 
-// Call user function on one device (for all services)
-static bool simpleVisit(const UPnPDeviceDesc& dev, UPnPDeviceDirectory::Visitor visit)
+// Call user function on one device (for all services). The services list is parsed if this was
+// not done yet.
+static bool simpleVisit(UPnPDeviceDesc& dev, UPnPDeviceDirectory::Visitor visit)
 {
+    dev.parseFull();
     for (const auto& service : dev.services) {
         if (!visit(dev, service)) {
             return false;
@@ -596,10 +629,9 @@ bool UPnPDeviceDirectory::traverse(UPnPDeviceDirectory::Visitor visit)
     return simpleTraverse(visit);
 }
 
-static bool deviceFound(const UPnPDeviceDesc&, const UPnPServiceDesc&)
+static void deviceFound()
 {
     devWaitCond.notify_all();
-    return true;
 }
 
 // Lookup a device in the pool. If not found and a search is active,
@@ -616,7 +648,11 @@ static bool getDevBySelector(bool cmp(const UPnPDeviceDesc& ddesc, const string&
         {
             std::unique_lock<std::mutex> lock(o_pool.m_mutex);
             for (auto& it : o_pool.m_devices) {
-                if (!cmp(it.second.device, value)) {
+                // The root device can be checked on the header fields. We need the full data
+                // to return it, or to look at the embedded devices if it does not match.
+                bool found = !cmp(it.second.device, value);
+                it.second.device.parseFull();
+                if (found) {
                     ddesc = it.second.device;
                     return true;
                 }
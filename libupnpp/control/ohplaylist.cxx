@@ -86,6 +86,9 @@ void OHPlaylist::evtCallback(const std::unordered_map<std::string, std::string>&
         return;
     }
     for (const auto& [varnm, varvalue] : props) {
+        if (varnm == "ProtocolInfo") {
+            updateCachedAction(varnm, "Value", varvalue);
+        }
         if (!reporter) {
             // For logging with no reporter set
             LOGDEB1("OHPlaylist::evtCallback: " << varnm << " -> " << varvalue << '\n');
@@ -103,7 +106,7 @@ void OHPlaylist::evtCallback(const std::unordered_map<std::string, std::string>&
             stringToBool(varvalue, &val);
             getReporter()->changed(varnm.c_str(), val ? 1 : 0);
         } else if (varnm == "Id" || varnm == "TracksMax") {
-            getReporter()->changed(varnm.c_str(), atoi(varvalue.c_str()));
+            getReporter()->changed(varnm.c_str(), stringToInt(varvalue));
         } else if (varnm == "IdArray") {
             // Decode IdArray. See how we call the client
             vector<int> v;
@@ -196,6 +199,42 @@ int OHPlaylist::id(int *value, int timeoutms)
     return runSimpleGet("Id", "Value", value, &opts);
 }
 
+bool OHPlaylist::transportStateAsync(std::function<void (int, TPState)> cb)
+{
+    SoapOutgoing args(getServiceType(), "TransportState");
+    return runActionAsync(args, [cb] (int status, SoapIncoming& data) {
+        TPState tps{TPS_Unknown};
+        string value;
+        if (status == UPNP_E_SUCCESS) {
+            if (!data.get("Value", &value)) {
+                LOGERR("OHPlaylist::transportStateAsync: missing Value in response\n");
+                status = UPNP_E_BAD_RESPONSE;
+            } else {
+                status = stringToTpState(value, &tps);
+            }
+        }
+        cb(status, tps);
+    });
+}
+
+bool OHPlaylist::idAsync(std::function<void (int, int)> cb, int timeoutms)
+{
+    SoapOutgoing args(getServiceType(), "Id");
+    ActionOptions opts;
+    if (timeoutms >= 0) {
+        opts.active_options |= AOM_TIMEOUTMS;
+        opts.timeoutms = timeoutms;
+    }
+    return runActionAsync(args, [cb] (int status, SoapIncoming& data) {
+        int value = 0;
+        if (status == UPNP_E_SUCCESS && !data.get("Value", &value)) {
+            LOGERR("OHPlaylist::idAsync: missing Value in response\n");
+            status = UPNP_E_BAD_RESPONSE;
+        }
+        cb(status, value);
+    }, &opts);
+}
+
 int OHPlaylist::read(int id, std::string* urip, UPnPDirObject *dirent)
 {
     SoapOutgoing args(getServiceType(), "Read");
@@ -214,7 +253,7 @@ int OHPlaylist::read(int id, std::string* urip, UPnPDirObject *dirent)
         LOGERR("OHPlaylist::Read: missing Uri in response" << '\n');
         return UPNP_E_BAD_RESPONSE;
     }
-    didl = SoapHelp::xmlUnquote(didl);
+    SoapHelp::xmlUnquoteInPlace(didl);
 
     UPnPDirContent dir;
     if (!dir.parse(didl)) {
@@ -272,7 +311,7 @@ protected:
             return;
         string str(s, len);
         if (m_path.back().name == "Id")
-            m_tt.id = atoi(str.c_str());
+            m_tt.id = stringToInt(str);
         else if (m_path.back().name == "Uri")
             m_tt.url = str;
         else if (m_path.back().name == "Metadata")
@@ -348,14 +387,8 @@ int OHPlaylist::tracksMax(int *valuep)
     return runSimpleGet("TracksMax", "Value", valuep);
 }
 
-int OHPlaylist::idArray(vector<int> *ids, int *tokp)
+static int decodeIdArray(SoapIncoming& data, vector<int> *ids, int *tokp)
 {
-    SoapOutgoing args(getServiceType(), "IdArray");
-    SoapIncoming data;
-    int ret = runAction(args, data);
-    if (ret != UPNP_E_SUCCESS) {
-        return ret;
-    }
     int ltok;
     if (!data.get("Token", &ltok)) {
         LOGERR("OHPlaylist::idArray: missing Token in response" << '\n');
@@ -373,6 +406,30 @@ int OHPlaylist::idArray(vector<int> *ids, int *tokp)
     return 0;
 }
 
+int OHPlaylist::idArray(vector<int> *ids, int *tokp)
+{
+    SoapOutgoing args(getServiceType(), "IdArray");
+    SoapIncoming data;
+    int ret = runAction(args, data);
+    if (ret != UPNP_E_SUCCESS) {
+        return ret;
+    }
+    return decodeIdArray(data, ids, tokp);
+}
+
+bool OHPlaylist::idArrayAsync(std::function<void (int, const vector<int>&, int)> cb)
+{
+    SoapOutgoing args(getServiceType(), "IdArray");
+    return runActionAsync(args, [cb] (int status, SoapIncoming& data) {
+        vector<int> ids;
+        int token = 0;
+        if (status == UPNP_E_SUCCESS) {
+            status = decodeIdArray(data, &ids, &token);
+        }
+        cb(status, ids, token);
+    });
+}
+
 int OHPlaylist::idArrayChanged(int token, bool *changed)
 {
     SoapOutgoing args(getServiceType(), "IdArrayChanged");
@@ -393,7 +450,7 @@ int OHPlaylist::protocolInfo(std::string *proto)
 {
     SoapOutgoing args(getServiceType(), "ProtocolInfo");
     SoapIncoming data;
-    int ret = runAction(args, data);
+    int ret = runCachedAction(args, data);
     if (ret != UPNP_E_SUCCESS) {
         return ret;
     }
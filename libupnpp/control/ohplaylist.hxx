@@ -18,6 +18,7 @@
 #ifndef _OHPLAYLIST_HXX_INCLUDED_
 #define _OHPLAYLIST_HXX_INCLUDED_
 
+#include <functional>
 #include <unordered_map>
 #include <string>
 #include <vector>
@@ -64,6 +65,13 @@ public:
                  };
     int transportState(TPState *tps);
     int id(int *value, int timeoutms = -1);
+    /** Asynchronous versions of the calls used for polling, see Service::runActionAsync().
+     * The callback values are only set if status is UPNP_E_SUCCESS.
+     * @return false if the action could not be queued. */
+    bool transportStateAsync(std::function<void (int status, TPState tps)> cb);
+    bool idAsync(std::function<void (int status, int id)> cb, int timeoutms = -1);
+    bool idArrayAsync(
+        std::function<void (int status, const std::vector<int>& ids, int token)> cb);
     int read(int id, std::string* uri, UPnPDirObject *dirent);
 
     struct TrackListEntry {
@@ -116,7 +116,7 @@ void OHProduct::evtCallback(const std::unordered_map<std::string, std::string>&
             continue;
         }
         if (propname == "SourceIndex") {
-            getReporter()->changed(propname.c_str(), atoi(propvalue.c_str()));
+            getReporter()->changed(propname.c_str(), stringToInt(propvalue));
         } else if (propname == "Standby") {
             bool val = false;
             stringToBool(propvalue, &val);
@@ -164,7 +164,7 @@ int OHProduct::sourceIndex(int *index)
     if ((ret = runSimpleGet("SourceIndex", "Value", &value)))
         return ret;
 
-    *index = atoi(value.c_str());
+    *index = stringToInt(value);
     return 0;
 }
 
@@ -77,13 +77,16 @@ void OHRadio::evtCallback(const std::unordered_map<std::string, std::string>& pr
 {
     LOGDEB1("OHRadio::evtCallback: getReporter(): " << getReporter() << '\n');
     for (const auto& [propname, propvalue] : props) {
+        if (propname == "ProtocolInfo") {
+            updateCachedAction(propname, "Value", propvalue);
+        }
         if (!getReporter()) {
             LOGDEB1("OHRadio::evtCallback: " << propname << " -> " << propvalue << '\n');
             continue;
         }
 
         if (propname == "Id" || propname == "ChannelsMax") {
-            getReporter()->changed(propname.c_str(), atoi(propvalue.c_str()));
+            getReporter()->changed(propname.c_str(), stringToInt(propvalue));
         } else if (propname == "IdArray") {
             // Decode IdArray. See how we call the client
             vector<int> v;
@@ -202,7 +205,7 @@ int OHRadio::protocolInfo(std::string *proto)
 {
     SoapOutgoing args(getServiceType(), "ProtocolInfo");
     SoapIncoming data;
-    int ret = runAction(args, data);
+    int ret = runCachedAction(args, data);
     if (ret != UPNP_E_SUCCESS) {
         return ret;
     }
@@ -274,7 +277,7 @@ protected:
             return;
         string str(s, len);
         if (m_path.back().name == "Id")
-            m_tt.id = atoi(str.c_str());
+            m_tt.id = stringToInt(str);
         else if (m_path.back().name == "Uri")
             m_tt.url = str;
         else if (m_path.back().name == "Metadata")
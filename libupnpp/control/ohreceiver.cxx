@@ -61,6 +61,9 @@ void OHReceiver::evtCallback(const std::unordered_map<std::string, std::string>&
 {
     LOGDEB1("OHReceiver::evtCallback:getReporter(): " << getReporter() << '\n');
     for (const auto& [propname, propvalue] : props) {
+        if (propname == "ProtocolInfo") {
+            updateCachedAction(propname, "Value", propvalue);
+        }
         if (!getReporter()) {
             LOGDEB1("OHReceiver::evtCallback: " << propname << " -> " << propvalue << '\n');
             continue;
@@ -142,7 +145,7 @@ int OHReceiver::protocolInfo(std::string *proto)
 {
     SoapOutgoing args(getServiceType(), "ProtocolInfo");
     SoapIncoming data;
-    int ret = runAction(args, data);
+    int ret = runCachedAction(args, data);
     if (ret != UPNP_E_SUCCESS) {
         return ret;
     }
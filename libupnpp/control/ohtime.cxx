@@ -64,7 +64,7 @@ void OHTime::evtCallback(const std::unordered_map<std::string, std::string>& pro
         }
 
         if (propname == "TrackCount" || propname == "Duration" || propname == "Seconds") {
-            reporter->changed(propname.c_str(), atoi(propvalue.c_str()));
+            reporter->changed(propname.c_str(), stringToInt(propvalue));
         } else {
             LOGERR("OHTime event: unknown variable: name [" <<
                    propname << "] value [" << propvalue << '\n');
@@ -58,16 +58,22 @@ void OHVolume::evtCallback(const std::unordered_map<std::string, std::string>& p
 {
     LOGDEB1("OHVolume::evtCallback: getReporter(): " << getReporter() << '\n');
     for (const auto& [propname, propvalue] : props) {
+        // The Characteristics values are also evented.
+        if (propname == "VolumeMax" || propname == "VolumeUnity" ||
+            propname == "VolumeSteps" || propname == "VolumeMilliDbPerStep" ||
+            propname == "BalanceMax" || propname == "FadeMax") {
+            updateCachedAction("Characteristics", propname, propvalue);
+        }
         if (!getReporter()) {
             LOGDEB1("OHVolume::evtCallback: " << propname << " -> " << propvalue << '\n');
             continue;
         }
 
         if (propname == "Volume") {
-            int vol = devVolTo0100(atoi(propvalue.c_str()));
+            int vol = devVolTo0100(stringToInt(propvalue));
             getReporter()->changed(propname.c_str(), vol);
         } else if (propname == "VolumeLimit") {
-            m_volmax = atoi(propvalue.c_str());
+            m_volmax = stringToInt(propvalue);
             LOGDEB1("OHVolume: event: VolumeLimit: " << m_volmax << '\n');
         } else if (propname == "Mute") {
             bool val = false;
@@ -196,7 +202,7 @@ int OHVolume::characteristics(OHVCharacteristics* c)
 {
     SoapOutgoing args(getServiceType(), "Characteristics");
     SoapIncoming data;
-    int ret = runAction(args, data);
+    int ret = runCachedAction(args, data);
     if (ret != UPNP_E_SUCCESS) {
         return ret;
     }
@@ -0,0 +1,289 @@
+/* Copyright (C) 2024 J.F.Dockes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301 USA
+ */
+#include "config.h"
+
+#include "libupnpp/control/protocolinfo.hxx"
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "libupnpp/log.hxx"
+#include "libupnpp/smallut.h"
+
+using namespace std;
+using namespace UPnPP;
+
+namespace UPnPClient {
+
+// Match scores. The MIME type match dominates, then the DLNA profile and the parameters.
+static const int SCORE_ANYMIME = 10;
+static const int SCORE_ANYSUBTYPE = 20;
+static const int SCORE_EXACTMIME = 30;
+static const int SCORE_PROFILE = 5;
+static const int SCORE_PARAM = 2;
+static const int SCORE_PROTOCOL = 1;
+
+static const string dlnapn{"dlna.org_pn"};
+
+// Case-insensitive comparison with an already lowercased string
+static bool iequal(string_view s, string_view lower)
+{
+    if (s.size() != lower.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < s.size(); i++) {
+        char c = s[i];
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        if (c != lower[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static string_view trimmed(string_view s)
+{
+    while (!s.empty() && s.front() == ' ') {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && s.back() == ' ') {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+// Split at the first occurrence of sep. The separator is dropped.
+static string_view splitfirst(string_view& s, char sep)
+{
+    auto pos = s.find(sep);
+    string_view first = s.substr(0, pos);
+    s = pos == string_view::npos ? string_view() : s.substr(pos + 1);
+    return first;
+}
+
+// Look for a name=value parameter in a ';'-separated list, case-insensitive on the name.
+static bool findparam(string_view params, string_view lowername, string_view *value)
+{
+    while (!params.empty()) {
+        string_view param = splitfirst(params, ';');
+        string_view name = trimmed(splitfirst(param, '='));
+        if (iequal(name, lowername)) {
+            *value = trimmed(param);
+            return true;
+        }
+    }
+    return false;
+}
+
+class ProtocolInfoMatcher::Internal {
+public:
+    struct SinkEntry {
+        // MIME parameters, lowercased
+        vector<pair<string, string>> params;
+        // DLNA profile, lowercased. Empty if none.
+        string profile;
+    };
+    // Protocol ("*" for any) -> MIME type ("type/subtype", "type/*" or "*") -> entries.
+    unordered_map<string, unordered_map<string, vector<SinkEntry>>> index;
+    size_t count{0};
+
+    void add(const ProtocolinfoEntry& e) {
+        if (e.protocol.empty() || e.contentFormat.empty()) {
+            return;
+        }
+        SinkEntry entry;
+        string mime = e.contentFormat;
+        if (e.protocol == "http-get") {
+            // parseProtoInfEntry() already split the parameters.
+            for (const auto& [name, value] : e.content_params) {
+                entry.params.emplace_back(name, value);
+            }
+        } else {
+            string_view rest(e.contentFormat);
+            mime = string(trimmed(splitfirst(rest, ';')));
+            while (!rest.empty()) {
+                string_view param = splitfirst(rest, ';');
+                string_view name = trimmed(splitfirst(param, '='));
+                if (!name.empty()) {
+                    entry.params.emplace_back(string(name), string(trimmed(param)));
+                }
+            }
+        }
+        string_view profile;
+        if (findparam(e.additional, dlnapn, &profile)) {
+            entry.profile = string(profile);
+        }
+        index[e.protocol][mime].push_back(std::move(entry));
+        count++;
+    }
+
+    // Resource protocolInfo fields, split and lowercased where needed.
+    struct ResInfo {
+        string protocol;
+        string mime;
+        string anysubtype;
+        string_view mimeparams;
+        bool hasprofile{false};
+        string_view profile;
+    };
+
+    // Best score for a resource among the entries for a protocol
+    int scoreProtocol(const string& protocol, const ResInfo& res) const {
+        auto pit = index.find(protocol);
+        if (pit == index.end()) {
+            return -1;
+        }
+        int best = -1;
+        auto scoremime = [&] (const string& key, int mimescore) {
+            auto mit = pit->second.find(key);
+            if (mit == pit->second.end()) {
+                return;
+            }
+            for (const auto& entry : mit->second) {
+                int score = scoreEntry(entry, mimescore, res);
+                if (score > best) {
+                    best = score;
+                }
+            }
+        };
+        scoremime(res.mime, SCORE_EXACTMIME);
+        if (!res.anysubtype.empty()) {
+            scoremime(res.anysubtype, SCORE_ANYSUBTYPE);
+        }
+        scoremime("*", SCORE_ANYMIME);
+        return best;
+    }
+
+    static int scoreEntry(const SinkEntry& entry, int score, const ResInfo& res) {
+        if (!entry.profile.empty() && res.hasprofile) {
+            if (!iequal(res.profile, entry.profile)) {
+                return -1;
+            }
+            score += SCORE_PROFILE;
+        }
+        for (const auto& [name, value] : entry.params) {
+            string_view resvalue;
+            if (findparam(res.mimeparams, name, &resvalue)) {
+                if (!iequal(resvalue, value)) {
+                    return -1;
+                }
+                score += SCORE_PARAM;
+            }
+        }
+        return score;
+    }
+
+    int score(string_view protoinfo) const {
+        ResInfo res;
+        string_view rest = protoinfo;
+        res.protocol = string(trimmed(splitfirst(rest, ':')));
+        splitfirst(rest, ':'); // network
+        string_view format = splitfirst(rest, ':');
+        if (res.protocol.empty() || format.empty()) {
+            return -1;
+        }
+        // The additional info is the rest, it may contain ':'
+        res.hasprofile = findparam(rest, dlnapn, &res.profile);
+        res.mime = string(trimmed(splitfirst(format, ';')));
+        res.mimeparams = format;
+        stringtolower(res.protocol);
+        stringtolower(res.mime);
+        auto slash = res.mime.find('/');
+        if (slash != string::npos) {
+            res.anysubtype = res.mime.substr(0, slash + 1) + "*";
+        }
+        int best = scoreProtocol(res.protocol, res);
+        if (best >= 0) {
+            best += SCORE_PROTOCOL;
+        }
+        int anyproto = scoreProtocol("*", res);
+        return anyproto > best ? anyproto : best;
+    }
+};
+
+ProtocolInfoMatcher::ProtocolInfoMatcher()
+    : m(std::make_shared<Internal>())
+{
+}
+
+ProtocolInfoMatcher::ProtocolInfoMatcher(const string& sinkinfo)
+{
+    vector<ProtocolinfoEntry> entries;
+    parseProtocolInfo(sinkinfo, entries);
+    auto ip = std::make_shared<Internal>();
+    for (const auto& entry : entries) {
+        ip->add(entry);
+    }
+    LOGDEB1("ProtocolInfoMatcher: " << ip->count << " sink entries\n");
+    m = ip;
+}
+
+ProtocolInfoMatcher::ProtocolInfoMatcher(const vector<ProtocolinfoEntry>& sinks)
+{
+    auto ip = std::make_shared<Internal>();
+    for (const auto& entry : sinks) {
+        ip->add(entry);
+    }
+    m = ip;
+}
+
+size_t ProtocolInfoMatcher::size() const
+{
+    return m->count;
+}
+
+int ProtocolInfoMatcher::score(string_view protoinfo) const
+{
+    if (m->count == 0) {
+        return -1;
+    }
+    return m->score(protoinfo);
+}
+
+int ProtocolInfoMatcher::score(const UPnPResource& res) const
+{
+    auto it = res.m_props.find("protocolInfo");
+    if (it == res.m_props.end()) {
+        return -1;
+    }
+    return score(it->second);
+}
+
+int ProtocolInfoMatcher::bestResource(const UPnPDirObject& obj, int *scorep) const
+{
+    int best = -1;
+    int bestscore = -1;
+    for (size_t i = 0; i < obj.m_resources.size(); i++) {
+        int sc = score(obj.m_resources[i]);
+        if (sc > bestscore) {
+            bestscore = sc;
+            best = static_cast<int>(i);
+        }
+    }
+    if (scorep) {
+        *scorep = bestscore;
+    }
+    return best;
+}
+
+} // namespace UPnPClient
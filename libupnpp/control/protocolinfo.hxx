@@ -0,0 +1,83 @@
+/* Copyright (C) 2024 J.F.Dockes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301 USA
+ */
+#ifndef _PROTOCOLINFO_HXX_INCLUDED_
+#define _PROTOCOLINFO_HXX_INCLUDED_
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "libupnpp/control/cdircontent.hxx"
+#include "libupnpp/upnpavutils.hxx"
+
+namespace UPnPClient {
+
+/**
+ * Compiled renderer sink ProtocolInfo list, for checking which resources it can play.
+ *
+ * The sink entries (as returned by ConnectionManager::getProtocolInfo() or
+ * OHPlaylist::protocolInfo()) are parsed once and indexed by protocol and MIME type, so that
+ * scoring a resource only looks at the few entries which can match it.
+ *
+ * A sink entry matches a resource protocolInfo if the protocols are the same and the MIME
+ * type matches (exactly, as type/\*, or as \*). MIME parameters present in the sink entry
+ * (e.g. rate and channels for audio/L16) must have the same value in the resource if it has
+ * them. If both have a DLNA.ORG_PN profile, it must be the same. More precise matches get
+ * higher scores.
+ *
+ * The object is cheap to copy and can be shared between threads.
+ */
+class UPNPP_API ProtocolInfoMatcher {
+public:
+    /** Empty matcher: nothing is playable */
+    ProtocolInfoMatcher();
+
+    /** Compile a comma-separated sink list */
+    explicit ProtocolInfoMatcher(const std::string& sinkinfo);
+
+    /** Compile already parsed sink entries */
+    explicit ProtocolInfoMatcher(const std::vector<UPnPP::ProtocolinfoEntry>& sinks);
+
+    /** Number of usable sink entries */
+    size_t size() const;
+    bool empty() const {
+        return size() == 0;
+    }
+
+    /** Score a resource protocolInfo string.
+     * @return -1 if no sink entry matches, else a positive value, higher for better matches. */
+    int score(std::string_view protoinfo) const;
+
+    /** Score a resource. -1 if it has no protocolInfo or can't be played. */
+    int score(const UPnPResource& res) const;
+
+    /** Find the best playable resource for an object. For equal scores, the first resource
+     * (normally the original format) is chosen.
+     * @param[out] score if not null, set to the resource score.
+     * @return the resource index, or -1 if none is playable. */
+    int bestResource(const UPnPDirObject& obj, int *score = nullptr) const;
+
+private:
+    class UPNPP_LOCAL Internal;
+    std::shared_ptr<const Internal> m;
+};
+
+} // namespace UPnPClient
+
+#endif /* _PROTOCOLINFO_HXX_INCLUDED_ */
@@ -76,24 +76,29 @@ bool RenderingControl::serviceInit(const UPnPDeviceDesc& device, const UPnPServi
 }
 
 // Translate device volume to 0-100
-int RenderingControl::devVolTo0100(int dev_vol)
+static int volTo0100(int dev_vol, int volmin, int volmax)
 {
     int volume;
-    if (dev_vol < m_volmin)
-        dev_vol = m_volmin;
-    if (dev_vol > m_volmax)
-        dev_vol = m_volmax;
-    if (m_volmin != 0 || m_volmax != 100) {
-        double fact = double(m_volmax - m_volmin) / 100.0;
+    if (dev_vol < volmin)
+        dev_vol = volmin;
+    if (dev_vol > volmax)
+        dev_vol = volmax;
+    if (volmin != 0 || volmax != 100) {
+        double fact = double(volmax - volmin) / 100.0;
         if (fact <= 0.0) // ??
             fact = 1.0;
-        volume = int((dev_vol - m_volmin) / fact);
+        volume = int((dev_vol - volmin) / fact);
     } else {
         volume = dev_vol;
     }
     return volume;
 }
 
+int RenderingControl::devVolTo0100(int dev_vol)
+{
+    return volTo0100(dev_vol, m_volmin, m_volmax);
+}
+
 const static std::string volumevarname{"Volume"};
 const static std::string mutevarname{"Mute"};
 
@@ -117,7 +122,7 @@ void RenderingControl::evtCallback(const std::unordered_map<std::string, std::st
         for (const auto& [propname, propvalue] : props) {
             LOGINF("    " << propname << " -> " << propvalue << "\n");
             if (beginswith(propname, volumevarname)) {
-                int vol = devVolTo0100(atoi(propvalue.c_str()));
+                int vol = devVolTo0100(stringToInt(propvalue));
                 reporter->changed(propname.c_str(), vol);
             } else if (beginswith(propname, mutevarname)) {
                 bool mute;
@@ -202,6 +207,23 @@ int RenderingControl::getVolume(const string& channel)
     return devVolTo0100(dev_volume);
 }
 
+bool RenderingControl::getVolumeAsync(std::function<void (int, int)> cb, const string& channel)
+{
+    SoapOutgoing args(getServiceType(), "GetVolume");
+    args("InstanceID", "0")("Channel", channel);
+    // Don't use this in the callback, the object may be gone.
+    int volmin = m_volmin;
+    int volmax = m_volmax;
+    return runActionAsync(args, [volmin, volmax, cb] (int status, SoapIncoming& data) {
+        int dev_volume = 0;
+        if (status == UPNP_E_SUCCESS && !data.get("CurrentVolume", &dev_volume)) {
+            LOGERR("RenderingControl:getVolumeAsync: missing CurrentVolume in response\n");
+            status = UPNP_E_BAD_RESPONSE;
+        }
+        cb(status, status == UPNP_E_SUCCESS ? volTo0100(dev_volume, volmin, volmax) : 0);
+    });
+}
+
 int RenderingControl::setMute(bool mute, const string& channel)
 {
     SoapOutgoing args(getServiceType(), "SetMute");
@@ -18,6 +18,7 @@
 #ifndef _RENDERINGCONTROL_HXX_INCLUDED_
 #define _RENDERINGCONTROL_HXX_INCLUDED_
 
+#include <functional>
 #include <string>
 
 #include "service.hxx"
@@ -52,6 +53,11 @@ public:
     int setVolume(int volume, const std::string& channel = "Master");
     /** @return current volume value (0-100) or negative for error. */
     int getVolume(const std::string& channel = "Master");
+    /** Asynchronous getVolume(), see Service::runActionAsync(). The callback gets the status
+     * and the volume value (0-100) if status is UPNP_E_SUCCESS.
+     * @return false if the action could not be queued. */
+    bool getVolumeAsync(std::function<void (int status, int volume)> cb,
+                        const std::string& channel = "Master");
     int setMute(bool mute, const std::string& channel = "Master");
     bool getMute(const std::string& channel = "Master");
 
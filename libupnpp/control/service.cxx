@@ -22,14 +22,21 @@
 #include <upnp.h>
 #include <upnptools.h>
 
+#include <atomic>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <string>
 #include <utility>
 
 #include "libupnpp/control/description.hxx"
+#include "libupnpp/control/discovery.hxx"
+#include "libupnpp/control/soapclient.hxx"
 #include "libupnpp/log.hxx"
 #include "libupnpp/smallut.h"
 #include "libupnpp/upnpp_p.hxx"
 #include "libupnpp/upnpplib.hxx"
+#include "libupnpp/workqueue.h"
 
 using namespace std::placeholders;
 using namespace UPnPP;
@@ -52,6 +59,10 @@ public:
     std::string friendlyName;
     std::string manufacturer;
     std::string modelName;
+    // Identifies the device description, for the cached action results.
+    std::string descsig;
+    // Send the actions with soapSendAction() instead of UpnpSendAction()
+    std::atomic<bool> persistent{false};
     Upnp_SID    SID; /* Subscription Id */
 
     void initFromDeviceAndService(const UPnPDeviceDesc& devdesc, const UPnPServiceDesc& servdesc) {
@@ -62,6 +73,7 @@ public:
         friendlyName = devdesc.friendlyName;
         manufacturer = devdesc.manufacturer;
         modelName = devdesc.modelName;
+        descsig = devdesc.descURL + '\n' + ulltodecstr(std::hash<std::string>()(devdesc.XMLText));
     }
     /* Tell the UPnP device (through libupnp) that we want to receive
        its events. This is called by registerCallback() and sets m_SID */
@@ -78,6 +90,17 @@ public:
 static std::unordered_map<std::string, evtCBFunc> o_calls;
 static std::mutex cblock;
 
+/** Cached action results, see runCachedAction(). Indexed by device UDN. */
+struct CachedResults {
+    // Description signature for the device when the results were stored.
+    std::string descsig;
+    // Service type and action name -> results
+    std::unordered_map<std::string, std::unordered_map<std::string, std::string>> results;
+};
+static std::unordered_map<std::string, CachedResults> o_cachedresults;
+static std::mutex o_cachedresultslock;
+static std::once_flag o_cachedresultsonce;
+
 
 Service::Service(const UPnPDeviceDesc& devdesc, const UPnPServiceDesc& servdesc)
     : m(new Internal())
@@ -153,27 +176,47 @@ const std::string& Service::getManufacturer() const
     return m->manufacturer;
 }
 
-int Service::runAction(const SoapOutgoing& args, SoapIncoming& data, ActionOptions *opts)
+void Service::setPersistentConnection(bool onoff)
 {
-    LibUPnP* lib = LibUPnP::getLibUPnP();
-    if (lib == 0) {
-        LOGINF("Service::runAction: no lib" << "\n");
-        return UPNP_E_OUTOF_MEMORY;
-    }
-    UpnpClient_Handle hdl = lib->m->getclh();
+    m->persistent = onoff;
+}
+
+bool Service::persistentConnection() const
+{
+    return m->persistent;
+}
 
+// Send an action. This only uses copies of the Service parameters, so that the asynchronous
+// actions do not depend on the Service object.
+static int sendAction(const std::string& actionURL, const std::string& serviceType,
+                      bool persistent, const SoapOutgoing::Internal& args, SoapIncoming& data,
+                      Service::ActionOptions *opts)
+{
     std::vector<std::pair<std::string, std::string>> response;
-    if (opts && (opts->active_options & AOM_TIMEOUTMS)) {
-        response.emplace_back("timeoutms", lltodecstr(opts->timeoutms));
-    }
     int errcode;
     std::string errdesc;
-    int ret =  UpnpSendAction(hdl, "", m->actionURL, m->serviceType,
-                              args.m->name, args.m->data, response, &errcode, errdesc);
+    int ret;
+    bool hastimeout = opts && (opts->active_options & Service::AOM_TIMEOUTMS);
+    if (persistent) {
+        ret = soapSendAction(actionURL, serviceType, args.name, args.data, response,
+                             hastimeout ? opts->timeoutms : -1, &errcode, errdesc);
+    } else {
+        LibUPnP* lib = LibUPnP::getLibUPnP();
+        if (lib == 0) {
+            LOGINF("Service::runAction: no lib" << "\n");
+            return UPNP_E_OUTOF_MEMORY;
+        }
+        UpnpClient_Handle hdl = lib->m->getclh();
+        if (hastimeout) {
+            response.emplace_back("timeoutms", lltodecstr(opts->timeoutms));
+        }
+        ret =  UpnpSendAction(hdl, "", actionURL, serviceType,
+                              args.name, args.data, response, &errcode, errdesc);
+    }
     if (ret != UPNP_E_SUCCESS) {
         LOGINF("Service::runAction: UpnpSendAction error " << ret << " for service: " <<
-               args.m->serviceType << " action: " << args.m->name << " args: " <<
-               SoapHelp::argsToStr(args.m->data.begin(), args.m->data.end()) << "\n");
+               args.serviceType << " action: " << args.name << " args: " <<
+               SoapHelp::argsToStr(args.data.begin(), args.data.end()) << "\n");
         if (ret < 0) {
             LOGINF("    error message: " << UpnpGetErrorMessage(ret) << "\n");
         } else {
@@ -181,11 +224,174 @@ int Service::runAction(const SoapOutgoing& args, SoapIncoming& data, ActionOptio
         }
         return ret;
     }
-    data.m->name = args.m->name;
+    data.m->name = args.name;
     data.m->args.insert(response.begin(), response.end());
     return UPNP_E_SUCCESS;
 }
 
+int Service::runAction(const SoapOutgoing& args, SoapIncoming& data, ActionOptions *opts)
+{
+    return sendAction(m->actionURL, m->serviceType, m->persistent, *args.m, data, opts);
+}
+
+int Service::runCachedAction(const SoapOutgoing& args, SoapIncoming& data)
+{
+    std::call_once(o_cachedresultsonce, [] () {
+        UPnPDeviceDirectory::addLostCallback(
+            [] (const UPnPDeviceDesc& device, const UPnPServiceDesc&) {
+                std::unique_lock<std::mutex> lock(o_cachedresultslock);
+                o_cachedresults.erase(device.UDN);
+                return true;
+            });
+    });
+    std::string key = m->serviceType + '\n' + args.m->name;
+    {
+        std::unique_lock<std::mutex> lock(o_cachedresultslock);
+        auto it = o_cachedresults.find(m->deviceId);
+        if (it != o_cachedresults.end() && it->second.descsig == m->descsig) {
+            auto rit = it->second.results.find(key);
+            if (rit != it->second.results.end()) {
+                data.m->name = args.m->name;
+                data.m->args = rit->second;
+                return UPNP_E_SUCCESS;
+            }
+        }
+    }
+    int ret = runAction(args, data);
+    if (ret != UPNP_E_SUCCESS) {
+        return ret;
+    }
+    std::unique_lock<std::mutex> lock(o_cachedresultslock);
+    CachedResults& entry = o_cachedresults[m->deviceId];
+    if (entry.descsig != m->descsig) {
+        // New device or changed description: forget the old values.
+        LOGDEB("Service::runCachedAction: new description for " << m->friendlyName << "\n");
+        entry.results.clear();
+        entry.descsig = m->descsig;
+    }
+    entry.results[key] = data.m->args;
+    return UPNP_E_SUCCESS;
+}
+
+void Service::updateCachedAction(const std::string& actnm, const std::string& valnm,
+                                 const std::string& value)
+{
+    std::unique_lock<std::mutex> lock(o_cachedresultslock);
+    auto it = o_cachedresults.find(m->deviceId);
+    if (it == o_cachedresults.end() || it->second.descsig != m->descsig) {
+        return;
+    }
+    auto rit = it->second.results.find(m->serviceType + '\n' + actnm);
+    if (rit != it->second.results.end()) {
+        rit->second[valnm] = value;
+    }
+}
+
+// Asynchronous actions, see runActionAsync(). The tasks are run by a library-wide pool of
+// threads, started on first use. They hold copies of the service parameters, not a reference
+// to the Service, which may be deleted before the action runs.
+struct ActionTask {
+    std::string actionURL;
+    std::string serviceType;
+    bool persistent{false};
+    SoapOutgoing::Internal args;
+    bool hasopts{false};
+    Service::ActionOptions opts;
+    Service::ActionCB cb;
+};
+
+static void freeActionTask(ActionTask*& task)
+{
+    delete task;
+    task = nullptr;
+}
+
+static std::atomic<int> o_actionworkers{8};
+
+class ActionPool {
+public:
+    ActionPool() {
+        m_queue.setTaskFreeFunc(freeActionTask);
+        m_queue.start(o_actionworkers, &ActionPool::worker, this);
+    }
+    ActionPool(const ActionPool&) = delete;
+    ActionPool& operator=(const ActionPool&) = delete;
+
+    static void *worker(void *arg) {
+        auto me = static_cast<ActionPool*>(arg);
+        for (;;) {
+            ActionTask *task{nullptr};
+            if (!me->m_queue.take(&task)) {
+                me->m_queue.workerExit();
+                return (void*)1;
+            }
+            if (nullptr == task) {
+                continue;
+            }
+            SoapIncoming data;
+            int ret = sendAction(task->actionURL, task->serviceType, task->persistent,
+                                 task->args, data, task->hasopts ? &task->opts : nullptr);
+            if (task->cb) {
+                task->cb(ret, data);
+            }
+            delete task;
+        }
+    }
+
+    WorkQueue<ActionTask*> m_queue{"ActionPool"};
+};
+
+static ActionPool& actionPool()
+{
+    static ActionPool pool;
+    return pool;
+}
+
+void Service::setActionWorkers(int nthreads)
+{
+    if (nthreads > 0) {
+        o_actionworkers = nthreads;
+    }
+}
+
+bool Service::runActionAsync(const SoapOutgoing& args, ActionCB cb, ActionOptions *opts)
+{
+    auto task = new ActionTask;
+    task->actionURL = m->actionURL;
+    task->serviceType = m->serviceType;
+    task->persistent = m->persistent;
+    task->args = *args.m;
+    if (opts) {
+        task->hasopts = true;
+        task->opts = *opts;
+    }
+    task->cb = cb;
+    if (!actionPool().m_queue.put(task)) {
+        LOGERR("Service::runActionAsync: can't queue " << args.m->name << "\n");
+        delete task;
+        return false;
+    }
+    return true;
+}
+
+std::future<int> Service::runActionAsync(const SoapOutgoing& args,
+                                         std::shared_ptr<SoapIncoming> data,
+                                         ActionOptions *opts)
+{
+    auto promise = std::make_shared<std::promise<int>>();
+    std::future<int> future = promise->get_future();
+    auto cb = [promise, data] (int status, SoapIncoming& result) {
+        if (data) {
+            std::swap(data->m, result.m);
+        }
+        promise->set_value(status);
+    };
+    if (!runActionAsync(args, cb, opts)) {
+        promise->set_value(UPNP_E_OUTOF_MEMORY);
+    }
+    return future;
+}
+
 int Service::runTrivialAction(const std::string& actionName, ActionOptions *opts)
 {
     SoapOutgoing args(m->serviceType, actionName);
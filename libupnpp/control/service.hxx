@@ -21,7 +21,9 @@
 #include <sys/types.h>
 
 #include <functional>
+#include <future>
 #include <iostream>
+#include <memory>
 #include <string>
 
 #include "libupnpp/upnppexports.hxx"
@@ -140,6 +142,17 @@ public:
     virtual int runAction(const UPnPP::SoapOutgoing& args,
                           UPnPP::SoapIncoming& data, ActionOptions *opts=nullptr);
 
+    /** Choose how the actions for this service are sent.
+     *
+     * By default, each action goes through npupnp, which opens a new TCP connection every
+     * time. With this set, the library sends the actions itself over persistent HTTP/1.1
+     * connections, pooled by device host, which saves a TCP handshake for each action after the
+     * first one (significant with slow Wi-Fi devices). The device must support keep-alive for
+     * this to make a difference, and IPv6 link-local control URLs are not supported.
+     */
+    void setPersistentConnection(bool onoff);
+    bool persistentConnection() const;
+
     /** Run trivial action where there are neither input parameters
         nor return data (beyond the status) */
     int runTrivialAction(const std::string& actionName, ActionOptions *opts=nullptr);
@@ -155,6 +168,37 @@ public:
                                            const std::string& valnm,
                                            T value, ActionOptions *opts=nullptr);
 
+    /** Completion callback for the asynchronous actions. Called from a library thread.
+     * @param status UPNP_E_SUCCESS or an error code.
+     * @param data the action output data. */
+    typedef std::function<void (int status, UPnPP::SoapIncoming& data)> ActionCB;
+
+    /** Run an action asynchronously.
+     *
+     * The actions are executed by a library-wide pool of threads (see setActionWorkers()),
+     * so that many devices can be driven without blocking one thread for each. The action
+     * does not use the Service object, which may be deleted before the callback is called:
+     * the callback must not use it either in this case.
+     *
+     * @param args the action name and arguments (copied).
+     * @param cb called with the result.
+     * @param opts optional action options (copied).
+     * @return false if the action could not be queued. The callback is not called in this
+     *   case.
+     */
+    bool runActionAsync(const UPnPP::SoapOutgoing& args, ActionCB cb,
+                        ActionOptions *opts=nullptr);
+
+    /** Same as above, returning a future for the status instead of calling a callback.
+     * @param[out] data receives the output data before the future becomes ready. */
+    std::future<int> runActionAsync(const UPnPP::SoapOutgoing& args,
+                                    std::shared_ptr<UPnPP::SoapIncoming> data,
+                                    ActionOptions *opts=nullptr);
+
+    /** Set the number of threads for the asynchronous actions (default 8). Only effective
+     * before the first asynchronous action is run. */
+    static void setActionWorkers(int nthreads);
+
     /** Get pointer to installed event reporter
      *
      * This is used by a derived class event handling method and
@@ -211,6 +255,23 @@ protected:
     /** Cancel subscription to the service events, forget installed callback */
     void unregisterCallback();
 
+    /** Run an action the result of which does not change while the device is up (capabilities
+     * and such), and cache the result.
+     *
+     * The cache is shared by the Service objects for the same device and service type. It is
+     * dropped when the device is lost (byebye message or expiry), or when the text or the URL
+     * of its description changes. A device which restarts quickly usually serves the same
+     * description, and the cache then survives the restart: the BOOTID.UPNP.ORG value which
+     * would tell us about it is not available from npupnp. Only use for actions without
+     * arguments.
+     */
+    int runCachedAction(const UPnPP::SoapOutgoing& args, UPnPP::SoapIncoming& data);
+
+    /** Update a value in the cached result for an action, typically from an event. Nothing is
+     * done if the result is not cached. */
+    void updateCachedAction(const std::string& actnm, const std::string& valnm,
+                            const std::string& value);
+
 private:
     class UPNPP_LOCAL Internal;
     Internal *m{nullptr};
@@ -0,0 +1,327 @@
+/* Copyright (C) 2024 J.F.Dockes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301 USA
+ */
+#include "config.h"
+
+#include "libupnpp/control/soapclient.hxx"
+
+#include <upnp.h>
+
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "libupnpp/expatmm.h"
+#include "libupnpp/log.hxx"
+#include "libupnpp/soaphelp.hxx"
+#include "libupnpp/upnpp_p.hxx"
+
+using namespace std;
+using namespace UPnPP;
+
+namespace UPnPClient {
+
+// Same as the npupnp default
+static const int DEFAULT_TIMEOUTMS = 30000;
+static const int CONNECT_TIMEOUTMS = 5000;
+// Max idle handles kept for one host. More can be in use at the same time.
+static const size_t MAXIDLEPERHOST = 4;
+
+// Pool of curl handles. Each handle keeps its connection open after a transfer, so we reuse the
+// handles for the same host.
+class HandlePool {
+public:
+    HandlePool() {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+    }
+    ~HandlePool() {
+        for (auto& [host, handles] : idle) {
+            for (auto hdl : handles) {
+                curl_easy_cleanup(hdl);
+            }
+        }
+    }
+    HandlePool(const HandlePool&) = delete;
+    HandlePool& operator=(const HandlePool&) = delete;
+
+    CURL *get(const string& host) {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            auto it = idle.find(host);
+            if (it != idle.end() && !it->second.empty()) {
+                CURL *hdl = it->second.back();
+                it->second.pop_back();
+                return hdl;
+            }
+        }
+        LOGDEB1("soapSendAction: new handle for " << host << "\n");
+        return curl_easy_init();
+    }
+
+    void put(const string& host, CURL *hdl) {
+        std::unique_lock<std::mutex> lock(mtx);
+        auto& handles = idle[host];
+        if (handles.size() >= MAXIDLEPERHOST) {
+            lock.unlock();
+            curl_easy_cleanup(hdl);
+            return;
+        }
+        handles.push_back(hdl);
+    }
+
+private:
+    std::mutex mtx;
+    unordered_map<string, vector<CURL*>> idle;
+};
+
+static HandlePool& handlePool()
+{
+    static HandlePool pool;
+    return pool;
+}
+
+// IPv6 scope ids by host address, see soapSetScopeId()
+static std::mutex o_scopeidsmutex;
+static unordered_map<string, long> o_scopeids;
+
+// Host part of an URL, with the brackets for an IPv6 address, without the port.
+static string urlHost(const string& url)
+{
+    auto pos = url.find("://");
+    pos = pos == string::npos ? 0 : pos + 3;
+    auto end = url.find_first_of(url[pos] == '[' ? "]" : ":/", pos);
+    if (end != string::npos && url[end] == ']') {
+        end++;
+    }
+    return url.substr(pos, end == string::npos ? string::npos : end - pos);
+}
+
+void soapSetScopeId(const string& url, long scopeid)
+{
+    std::unique_lock<std::mutex> lock(o_scopeidsmutex);
+    o_scopeids[urlHost(url)] = scopeid;
+}
+
+static long scopeIdFor(const string& url)
+{
+    string host = urlHost(url);
+    if (host.empty() || host[0] != '[') {
+        return -1;
+    }
+    std::unique_lock<std::mutex> lock(o_scopeidsmutex);
+    auto it = o_scopeids.find(host);
+    return it == o_scopeids.end() ? -1 : it->second;
+}
+
+static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    size_t realsize = size * nmemb;
+    string* out = (string*)userp;
+    out->append((const char *)contents, realsize);
+    return realsize;
+}
+
+static void buildEnvelope(const string& serviceType, const string& actname,
+                          const vector<pair<string, string>>& args, string& body)
+{
+    body = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n"
+        "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+        "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+        "<s:Body><u:";
+    body += actname;
+    body += " xmlns:u=\"";
+    body += serviceType;
+    body += "\">";
+    for (const auto& [name, value] : args) {
+        body += '<';
+        body += name;
+        body += '>';
+        body += SoapHelp::xmlQuote(value);
+        body += "</";
+        body += name;
+        body += '>';
+    }
+    body += "</u:";
+    body += actname;
+    body += "></s:Body></s:Envelope>\r\n";
+}
+
+// Element name without the namespace prefix (the parser is not namespace-aware)
+static const char *localname(const string& name)
+{
+    auto pos = name.find(':');
+    return pos == string::npos ? name.c_str() : name.c_str() + pos + 1;
+}
+
+// Parse the response envelope. The output arguments are the children of the response element,
+// which is the first child of the Body. For a fault, we look for the UPnPError fields.
+class SoapResponseParser : public inputRefXMLParser {
+public:
+    SoapResponseParser(const string& input, vector<pair<string, string>>& response)
+        : inputRefXMLParser(input), m_response(response) {}
+
+    string respname;
+    bool isfault{false};
+    int errcode{-1};
+    string errdesc;
+
+protected:
+    void StartElement(const XML_Char *, const XML_Char **) override {
+        m_chardata.clear();
+        if (m_bodydepth == 0) {
+            if (!strcmp(localname(m_path.back().name), "Body")) {
+                m_bodydepth = m_path.size();
+            }
+        } else if (m_path.size() == m_bodydepth + 1) {
+            respname = localname(m_path.back().name);
+            isfault = respname == "Fault";
+        }
+    }
+    void EndElement(const XML_Char *) override {
+        if (m_bodydepth == 0 || m_path.size() <= m_bodydepth + 1) {
+            if (m_path.size() == m_bodydepth) {
+                m_bodydepth = 0;
+            }
+            return;
+        }
+        const char *name = localname(m_path.back().name);
+        if (isfault) {
+            if (!strcmp(name, "errorCode")) {
+                stringToInt(m_chardata, &errcode);
+            } else if (!strcmp(name, "errorDescription")) {
+                errdesc = m_chardata;
+            }
+        } else if (m_path.size() == m_bodydepth + 2) {
+            m_response.emplace_back(name, m_chardata);
+        }
+        m_chardata.clear();
+    }
+    void CharacterData(const XML_Char *s, int len) override {
+        m_chardata.append(s, len);
+    }
+
+private:
+    vector<pair<string, string>>& m_response;
+    size_t m_bodydepth{0};
+    string m_chardata;
+};
+
+// Translate a curl transfer error
+static int curlErrorToUpnp(CURLcode code)
+{
+    switch (code) {
+    case CURLE_OUT_OF_MEMORY: return UPNP_E_OUTOF_MEMORY;
+    case CURLE_URL_MALFORMAT: return UPNP_E_INVALID_URL;
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT: return UPNP_E_SOCKET_CONNECT;
+    case CURLE_OPERATION_TIMEDOUT: return UPNP_E_TIMEDOUT;
+    case CURLE_SEND_ERROR: return UPNP_E_SOCKET_WRITE;
+    case CURLE_RECV_ERROR: return UPNP_E_SOCKET_READ;
+    default: return UPNP_E_SOCKET_ERROR;
+    }
+}
+
+int soapSendAction(
+    const string& actionURL, const string& serviceType, const string& actname,
+    const vector<pair<string, string>>& args, vector<pair<string, string>>& response,
+    int timeoutms, int *errcodep, string& errdesc)
+{
+    string host = baseurl(actionURL);
+    CURL *hdl = handlePool().get(host);
+    if (nullptr == hdl) {
+        LOGERR("soapSendAction: curl_easy_init failed\n");
+        return UPNP_E_OUTOF_MEMORY;
+    }
+
+    string body;
+    buildEnvelope(serviceType, actname, args, body);
+    string soapaction = string("SOAPACTION: \"") + serviceType + "#" + actname + "\"";
+    struct curl_slist *headers = nullptr;
+    headers = curl_slist_append(headers, "Content-Type: text/xml; charset=\"utf-8\"");
+    headers = curl_slist_append(headers, soapaction.c_str());
+    // No "100 continue" round trip.
+    headers = curl_slist_append(headers, "Expect:");
+
+    string out;
+    // The handle keeps the previous options, reset them all but the connection stays.
+    curl_easy_reset(hdl);
+    curl_easy_setopt(hdl, CURLOPT_URL, actionURL.c_str());
+    curl_easy_setopt(hdl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+    curl_easy_setopt(hdl, CURLOPT_POST, 1L);
+    curl_easy_setopt(hdl, CURLOPT_POSTFIELDS, body.c_str());
+    curl_easy_setopt(hdl, CURLOPT_POSTFIELDSIZE, long(body.size()));
+    curl_easy_setopt(hdl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(hdl, CURLOPT_TCP_NODELAY, 1L);
+    curl_easy_setopt(hdl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(hdl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(hdl, CURLOPT_TIMEOUT_MS, long(timeoutms >= 0 ? timeoutms : DEFAULT_TIMEOUTMS));
+    curl_easy_setopt(hdl, CURLOPT_CONNECTTIMEOUT_MS, long(CONNECT_TIMEOUTMS));
+    curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(hdl, CURLOPT_WRITEDATA, &out);
+    long scopeid = scopeIdFor(actionURL);
+    if (scopeid != -1) {
+        curl_easy_setopt(hdl, CURLOPT_ADDRESS_SCOPE, scopeid);
+    }
+
+    CURLcode res = curl_easy_perform(hdl);
+    long httpcode = 0;
+    if (res == CURLE_OK) {
+        curl_easy_getinfo(hdl, CURLINFO_RESPONSE_CODE, &httpcode);
+    }
+    curl_slist_free_all(headers);
+    if (res != CURLE_OK) {
+        LOGINF("soapSendAction: " << actionURL << " " << actname << ": " <<
+               curl_easy_strerror(res) << "\n");
+        // Don't keep a handle which may have a broken connection.
+        curl_easy_cleanup(hdl);
+        return curlErrorToUpnp(res);
+    }
+    handlePool().put(host, hdl);
+
+    if (httpcode != 200 && httpcode != 500) {
+        LOGINF("soapSendAction: " << actionURL << " " << actname << ": HTTP status " <<
+               httpcode << "\n");
+        return UPNP_E_BAD_RESPONSE;
+    }
+    SoapResponseParser parser(out, response);
+    if (!parser.Parse()) {
+        LOGINF("soapSendAction: " << actname << ": response parse failed: " <<
+               parser.getLastErrorMessage() << "\n");
+        return UPNP_E_BAD_RESPONSE;
+    }
+    if (parser.isfault) {
+        if (parser.errcode <= 0) {
+            return UPNP_E_BAD_RESPONSE;
+        }
+        *errcodep = parser.errcode;
+        errdesc = parser.errdesc;
+        return parser.errcode;
+    }
+    if (httpcode != 200 || parser.respname != actname + "Response") {
+        LOGINF("soapSendAction: " << actname << ": unexpected response element [" <<
+               parser.respname << "] HTTP status " << httpcode << "\n");
+        return UPNP_E_BAD_RESPONSE;
+    }
+    return UPNP_E_SUCCESS;
+}
+
+}
@@ -0,0 +1,60 @@
+/* Copyright (C) 2024 J.F.Dockes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301 USA
+ */
+#ifndef _SOAPCLIENT_H_X_INCLUDED_
+#define _SOAPCLIENT_H_X_INCLUDED_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace UPnPClient {
+
+/**
+ * Send a SOAP action over a persistent HTTP connection.
+ *
+ * This is an alternative to UpnpSendAction(), with the same parameters and return values. The
+ * curl handles are pooled by host and reused, so that successive actions to the same device
+ * normally go over the same keep-alive TCP connection instead of opening a new one each time.
+ *
+ * @param actionURL the service control URL.
+ * @param serviceType the service type, used for the SOAPACTION header and the namespace.
+ * @param actname the action name.
+ * @param args the action arguments (not quoted).
+ * @param[out] response the output arguments.
+ * @param timeoutms the total timeout for the action. Use a default value if negative.
+ * @param[out] errcodep the UPnP error code if the device returned a SOAP fault.
+ * @param[out] errdesc the UPnP error description if the device returned a SOAP fault.
+ * @return UPNP_E_SUCCESS, the UPnP error code (> 0) for a SOAP fault, or a negative
+ *   UPNP_E_XXX value for a transport or protocol error.
+ */
+extern int soapSendAction(
+    const std::string& actionURL, const std::string& serviceType, const std::string& actname,
+    const std::vector<std::pair<std::string, std::string>>& args,
+    std::vector<std::pair<std::string, std::string>>& response,
+    int timeoutms, int *errcodep, std::string& errdesc);
+
+/**
+ * Record the IPv6 scope id for the host in an URL, from the address a device was discovered
+ * on. This is needed to connect to a link-local address, like downloadUrlWithCurl() does for
+ * the description.
+ */
+extern void soapSetScopeId(const std::string& url, long scopeid);
+
+}
+
+#endif /* _SOAPCLIENT_H_X_INCLUDED_ */
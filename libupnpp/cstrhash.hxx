@@ -0,0 +1,81 @@
+/* Copyright (C) 2024 J.F.Dockes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *   02110-1301 USA
+ */
+#ifndef _CSTRHASH_HXX_INCLUDED_
+#define _CSTRHASH_HXX_INCLUDED_
+
+/* Private to the library. Compile-time string hashing, used to dispatch on the fixed sets of
+ * XML tag names and enumerated values that we know about, with a switch instead of a chain of
+ * string comparisons:
+ *
+ *     switch (strhash(name)) {
+ *     case strhash("container"): ...
+ *
+ * The case labels are computed by the compiler, which also refuses duplicate labels: a
+ * collision inside one of our sets is a build error, so each switch is a perfect hash of its
+ * set. Input values which are not in the set can still collide with a member, so a hash match
+ * must be confirmed by a string comparison.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace UPnPP {
+
+// 32 bits FNV-1a
+constexpr uint32_t strhash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ static_cast<unsigned char>(s[i])) * 16777619u;
+    }
+    return h;
+}
+
+constexpr uint32_t strhash(const char *s)
+{
+    return strhash(s, std::char_traits<char>::length(s));
+}
+
+inline uint32_t strhash(const std::string& s)
+{
+    return strhash(s.c_str(), s.size());
+}
+
+// Same as above but ASCII case-insensitive: the input is folded to upper case before hashing,
+// so the case labels must be upper-case.
+constexpr uint32_t strhashupper(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if (c >= 'a' && c <= 'z')
+            c -= 'a' - 'A';
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
+inline uint32_t strhashupper(const std::string& s)
+{
+    return strhashupper(s.c_str(), s.size());
+}
+
+} // namespace UPnPP
+
+#endif /* _CSTRHASH_HXX_INCLUDED_ */
@@ -201,6 +201,10 @@ protected:
     virtual void DefaultHandler(const XML_Char *, int) {}
     virtual void CDataStart(void) {}
     virtual void CDataEnd(void) {}
+    /* Return false to avoid storing the attributes in the m_path entry
+     * (which is already pushed when this is called). They are still
+     * passed to StartElement() */
+    virtual bool KeepAttributes(const XML_Char *) { return true; }
 
     /* The handle for the parser (expat) */
     XML_Parser expat_parser;
@@ -245,8 +249,10 @@ private:
             me->m_path.emplace_back(name);
             StackEl& lastelt = me->m_path.back();
             lastelt.start_index = XML_GetCurrentByteIndex(me->expat_parser);
-            for (int i = 0; atts[i] != nullptr; i += 2) {
-                lastelt.attributes[atts[i]] = atts[i+1];
+            if (me->KeepAttributes(name)) {
+                for (int i = 0; atts[i] != nullptr; i += 2) {
+                    lastelt.attributes[atts[i]] = atts[i+1];
+                }
             }
             me->StartElement(name, atts);
         }
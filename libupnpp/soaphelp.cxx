@@ -20,8 +20,10 @@
 #include "libupnpp/upnpp_p.hxx"
 #include "libupnpp/soaphelp.hxx"
 
+#include <charconv>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include <iostream>
 #include <vector>
@@ -70,8 +72,7 @@ bool SoapIncoming::get(const char *nm, int *value) const
     if (it == m->args.end() || it->second.empty()) {
         return false;
     }
-    *value = atoi(it->second.c_str());
-    return true;
+    return stringToInt(it->second, value);
 }
 
 bool SoapIncoming::get(const char *nm, string *value) const
@@ -84,74 +85,169 @@ bool SoapIncoming::get(const char *nm, string *value) const
     return true;
 }
 
-string SoapHelp::xmlQuote(const string& in)
+// The quoting functions are called for every action argument and event value, and on
+// possibly big DIDL documents. They look for the special characters and copy the runs in
+// between in one go, and return early if there is nothing to change.
+
+// Quoted size increase for each character, 0 if it needs no quoting
+static const unsigned char quotedextra[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    // 0x20-0x2f: " & '
+    0, 0, 5, 0, 0, 0, 4, 5, 0, 0, 0, 0, 0, 0, 0, 0,
+    // 0x30-0x3f: < >
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0, 3, 0,
+};
+
+static const char *quotedchar(char c)
 {
-    string out;
-    for (auto c : in) {
-        switch (c) {
-        case '"':
-            out += "&quot;";
-            break;
-        case '&':
-            out += "&amp;";
-            break;
-        case '<':
-            out += "&lt;";
-            break;
-        case '>':
-            out += "&gt;";
+    switch (c) {
+    case '"': return "&quot;";
+    case '&': return "&amp;";
+    case '<': return "&lt;";
+    case '>': return "&gt;";
+    case '\'': return "&apos;";
+    default: return nullptr;
+    }
+}
+
+static inline size_t quoteextra(char c)
+{
+    return quotedextra[static_cast<unsigned char>(c)];
+}
+
+// Offset of the first character needing quoting, or len
+static size_t firstquoted(const char *cp, size_t len)
+{
+    size_t i = 0;
+    // Unrolled: most strings have nothing to quote and this is the only loop we go through.
+    for (; i + 4 <= len; i += 4) {
+        if (quoteextra(cp[i]) | quoteextra(cp[i+1]) | quoteextra(cp[i+2]) |
+            quoteextra(cp[i+3])) {
             break;
-        case '\'':
-            out += "&apos;";
+        }
+    }
+    for (; i < len; i++) {
+        if (quoteextra(cp[i])) {
             break;
-        default:
-            out += c;
         }
     }
-    return out;
+    return i;
 }
 
-string SoapHelp::xmlUnquote(const string& in)
+string SoapHelp::xmlQuote(const string& in)
 {
+    size_t first = firstquoted(in.data(), in.size());
+    if (first == in.size()) {
+        return in;
+    }
     string out;
-    for (unsigned int i = 0; i < in.size(); i++) {
-        if (in[i] == '&') {
-            unsigned int j;
-            for (j = i; j < in.size(); j++) {
-                if (in[j] == ';') {
-                    break;
-                }
-            }
-            if (in[j] != ';') {
-                out += in.substr(i);
-                return out;
-            }
-            string entname = in.substr(i + 1, j - i - 1);
-            //cerr << "entname [" << entname << "]" << endl;
-            if (entname == "quot") {
-                out += '"';
-            } else if (entname == "amp") {
-                out += '&';
-            } else if (entname == "lt") {
-                out += '<';
-            } else if (entname == "gt") {
-                out += '>';
-            } else if (entname == "apos") {
-                out += '\'';
-            } else {
-                out += in.substr(i, j - i + 1);
-            }
-            i = j;
+    out.reserve(in.size() + in.size() / 8 + 16);
+    out.append(in, 0, first);
+    const char *cp = in.data();
+    size_t len = in.size();
+    size_t i = first;
+    while (i < len) {
+        out += quotedchar(cp[i]);
+        size_t start = ++i;
+        i += firstquoted(cp + start, len - start);
+        out.append(cp + start, i - start);
+    }
+    return out;
+}
+
+bool SoapHelp::xmlQuoteInPlace(string& s)
+{
+    size_t len = s.size();
+    size_t first = firstquoted(s.data(), len);
+    if (first == len) {
+        return false;
+    }
+    size_t extra = 0;
+    for (size_t i = first; i < len; i++) {
+        extra += quoteextra(s[i]);
+    }
+    // Expand, then fill from the end so that nothing is overwritten before it is read.
+    s.resize(len + extra);
+    char *cp = &s[0];
+    size_t w = len + extra;
+    for (size_t r = len; r > first; ) {
+        char c = cp[--r];
+        const char *q = quotedchar(c);
+        if (q) {
+            size_t qlen = quoteextra(c) + 1;
+            w -= qlen;
+            memcpy(cp + w, q, qlen);
         } else {
-            out += in[i];
+            cp[--w] = c;
+        }
+    }
+    return true;
+}
+
+// Decode from in to out, which may be the same buffer: the output is never longer than the
+// input. Only the predefined XML entities are decoded, anything else is copied. Returns the
+// output length.
+static size_t unquoteto(const char *in, size_t len, char *out)
+{
+    static const struct {
+        const char *name;
+        size_t len;
+        char c;
+    } entities[] = {{"amp;", 4, '&'}, {"lt;", 3, '<'}, {"gt;", 3, '>'},
+                    {"quot;", 5, '"'}, {"apos;", 5, '\''}};
+    size_t r = 0, w = 0;
+    while (r < len) {
+        auto amp = static_cast<const char *>(memchr(in + r, '&', len - r));
+        size_t run = (amp ? static_cast<size_t>(amp - in) : len) - r;
+        if (out + w != in + r) {
+            memmove(out + w, in + r, run);
+        }
+        r += run;
+        w += run;
+        if (nullptr == amp) {
+            break;
         }
+        r++;
+        char c = '&';
+        for (const auto& ent : entities) {
+            if (len - r >= ent.len && memcmp(in + r, ent.name, ent.len) == 0) {
+                c = ent.c;
+                r += ent.len;
+                break;
+            }
+        }
+        out[w++] = c;
+    }
+    return w;
+}
+
+string SoapHelp::xmlUnquote(const string& in)
+{
+    if (in.find('&') == string::npos) {
+        return in;
     }
+    string out(in.size(), 0);
+    out.resize(unquoteto(in.data(), in.size(), &out[0]));
     return out;
 }
 
+bool SoapHelp::xmlUnquoteInPlace(string& s)
+{
+    size_t first = s.find('&');
+    if (first == string::npos) {
+        return false;
+    }
+    size_t len = unquoteto(s.data() + first, s.size() - first, &s[first]);
+    s.resize(first + len);
+    return true;
+}
+
 string SoapHelp::i2s(int val)
 {
-    return lltodecstr(val);
+    // Short enough for the std::string small buffer: no allocation.
+    char buf[12];
+    return string(buf, std::to_chars(buf, buf + sizeof(buf), val).ptr - buf);
 }
 
 
@@ -61,6 +61,10 @@ namespace SoapHelp {
 std::string UPNPP_API xmlQuote(const std::string& in);
 /** Decode encoded XML data */
 std::string UPNPP_API xmlUnquote(const std::string& in);
+/** Same as xmlQuote(), modifying the string. @return true if it was changed. */
+bool UPNPP_API xmlQuoteInPlace(std::string& s);
+/** Same as xmlUnquote(), modifying the string. @return true if it was changed. */
+bool UPNPP_API xmlUnquoteInPlace(std::string& s);
 std::string UPNPP_API i2s(int val);
 inline std::string val2s(const std::string& val)
 {
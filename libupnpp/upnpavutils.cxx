@@ -22,7 +22,9 @@
 #include "Winsock2.h"
 #endif
 
-#include <cstdio>
+#include <charconv>
+#include <cstring>
+#include <limits>
 #include <string>
 
 #include "libupnpp/upnpavutils.hxx"
@@ -37,6 +39,26 @@ namespace UPnPP {
 // Format duration in milliseconds into UPnP duration format
 string upnpduration(int ms)
 {
+    // This is the format from the ref doc, but it appears that the
+    // decimal part in the seconds field is an issue with some control
+    // points. So drop it...
+    char cbuf[20];
+    return string(cbuf, upnpdurationtobuf(ms, cbuf, sizeof(cbuf), false));
+}
+
+// Append a 2 digits field
+static inline char *twodigits(char *cp, int val)
+{
+    *cp++ = '0' + val / 10;
+    *cp++ = '0' + val % 10;
+    return cp;
+}
+
+size_t upnpdurationtobuf(int ms, char *buf, size_t bufsize, bool withms)
+{
+    if (ms < 0) {
+        ms = 0;
+    }
     int hours = ms / (3600 * 1000);
     ms -= hours * 3600 * 1000;
     int minutes = ms / (60 * 1000);
@@ -44,24 +66,98 @@ string upnpduration(int ms)
     int secs = ms / 1000;
     ms -= secs * 1000;
 
-    char cbuf[100];
+    // Max int: 596 hours
+    char cbuf[20];
+    char *cp = std::to_chars(cbuf, cbuf + sizeof(cbuf), hours).ptr;
+    *cp++ = ':';
+    cp = twodigits(cp, minutes);
+    *cp++ = ':';
+    cp = twodigits(cp, secs);
+    if (withms) {
+        *cp++ = '.';
+        *cp++ = '0' + ms / 100;
+        cp = twodigits(cp, ms % 100);
+    }
+    size_t len = cp - cbuf;
+    if (len > bufsize) {
+        return 0;
+    }
+    memcpy(buf, cbuf, len);
+    return len;
+}
 
-    // This is the format from the ref doc, but it appears that the
-    // decimal part in the seconds field is an issue with some control
-    // points. So drop it...
-    //  sprintf(cbuf, "%d:%02d:%02d.%03d", hours, minutes, secs, ms);
-    sprintf(cbuf, "%d:%02d:%02d", hours, minutes, secs);
-    return cbuf;
+// Parse an unsigned decimal field, advancing the pointer
+static bool parsefield(const char *& cp, const char *end, int *val)
+{
+    auto res = std::from_chars(cp, end, *val);
+    if (res.ec != std::errc() || *val < 0) {
+        return false;
+    }
+    cp = res.ptr;
+    return true;
 }
 
-// H:M:S to seconds
-int upnpdurationtos(const string& dur)
+bool parseupnpduration(string_view dur, int *ms)
 {
+    const char *cp = dur.data();
+    const char *end = cp + dur.size();
+    while (cp < end && *cp == ' ') {
+        cp++;
+    }
+    if (cp < end && *cp == '+') {
+        cp++;
+    }
     int hours, minutes, seconds;
-    if (sscanf(dur.c_str(), "%d:%d:%d", &hours, &minutes, &seconds) != 3) {
-        return 0;
+    if (!parsefield(cp, end, &hours) || cp == end || *cp++ != ':' ||
+        !parsefield(cp, end, &minutes) || cp == end || *cp++ != ':' ||
+        !parsefield(cp, end, &seconds)) {
+        return false;
+    }
+    int64_t total = (3600 * int64_t(hours) + 60 * minutes + seconds) * 1000;
+    if (cp < end && *cp == '.') {
+        // .F+ (decimal fraction), or .F0/F1 (F0 / F1 seconds)
+        cp++;
+        const char *fstart = cp;
+        int64_t frac = 0, scale = 1;
+        for (; cp < end && *cp >= '0' && *cp <= '9'; cp++) {
+            // Only the first few digits matter for milliseconds.
+            if (scale < 1000000) {
+                frac = frac * 10 + (*cp - '0');
+                scale *= 10;
+            }
+        }
+        if (cp < end && *cp == '/') {
+            cp++;
+            int num, den;
+            auto res = std::from_chars(fstart, cp - 1, num);
+            if (res.ec != std::errc() || !parsefield(cp, end, &den) || den <= 0) {
+                return false;
+            }
+            total += int64_t(num) * 1000 / den;
+        } else if (cp > fstart) {
+            total += frac * 1000 / scale;
+        }
+    }
+    if (total > std::numeric_limits<int>::max()) {
+        return false;
     }
-    return 3600 * hours + 60 * minutes + seconds;
+    *ms = static_cast<int>(total);
+    return true;
+}
+
+// H:M:S to seconds
+int upnpdurationtos(const string& dur)
+{
+    int ms = 0;
+    parseupnpduration(dur, &ms);
+    return ms / 1000;
+}
+
+int upnpdurationtoms(const string& dur)
+{
+    int ms = 0;
+    parseupnpduration(dur, &ms);
+    return ms;
 }
 
 // Decode OHPlaylist IdArray: base64-encoded array of binary msb
@@ -19,6 +19,7 @@
 #define _UPNPAVUTILS_HXX_INCLUDED_
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
 
@@ -29,9 +30,24 @@ namespace UPnPP {
 /** Format milliseconds into H+:MM:SS */
 std::string UPNPP_API upnpduration(int ms);
 
-/** H+:MM:SS to seconds */
+/** Format milliseconds into H+:MM:SS, or H+:MM:SS.mmm if @param withms is set, without
+ * allocating.
+ * @param buf output buffer. 20 bytes are always enough.
+ * @return the formatted length (the output is not null-terminated), or 0 if the buffer is
+ *   too small. */
+size_t UPNPP_API upnpdurationtobuf(int ms, char *buf, size_t bufsize, bool withms = false);
+
+/** Parse a H+:MM:SS[.F+] or H+:MM:SS[.F0/F1] duration.
+ * @param[out] ms the duration in milliseconds, including the fractional seconds.
+ * @return false if the syntax is bad, in which case @param ms is not changed. */
+bool UPNPP_API parseupnpduration(std::string_view dur, int *ms);
+
+/** H+:MM:SS to seconds (the fractional part is dropped). 0 for a bad value. */
 int UPNPP_API upnpdurationtos(const std::string& dur);
 
+/** H+:MM:SS[.fff] to milliseconds. 0 for a bad value. */
+int UPNPP_API upnpdurationtoms(const std::string& dur);
+
 /** Decode OH playlist id array */
 bool UPNPP_API ohplIdArrayToVec(const std::string& data, std::vector<int> *ids);
 
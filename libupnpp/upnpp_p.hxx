@@ -27,6 +27,7 @@
 #include <time.h>
 
 #include <string>
+#include <string_view>
 #include <mutex>
 #include <unordered_map>
 #include <vector>
@@ -70,7 +71,19 @@ template <class T> bool csvToStrings(const std::string& s, T &tokens);
 
 // @return false if s does not look like a bool at all (does not begin
 // with [FfNnYyTt01]
-extern bool stringToBool(const std::string& s, bool *v);
+extern bool stringToBool(std::string_view s, bool *v);
+
+// Parse a decimal integer, with the same syntax as atoi() (leading spaces and sign, stops at
+// the first non-digit), but without needing a null-terminated string.
+// @return false if there is no number (or it overflows), in which case v is not changed.
+extern bool stringToInt(std::string_view s, int *v);
+// Same, returning 0 if there is no number, like atoi().
+inline int stringToInt(std::string_view s)
+{
+    int v = 0;
+    stringToInt(s, &v);
+    return v;
+}
 
 /** Sanitize URL which is supposedly already encoded but maybe not fully */
 std::string reSanitizeURL(const std::string& in);
@@ -24,6 +24,7 @@
 #include <ctime>
 #include <cstdarg>
 #include <algorithm>
+#include <charconv>
 
 #ifdef __MACH__
 #include <mach/clock.h>
@@ -637,8 +638,11 @@ std::string reSanitizeURL(const std::string& in)
 }
 
 // Note: this differs from smallut stringToBool. Check one day if this is necessary ?
-bool stringToBool(const string& s, bool *value)
+bool stringToBool(string_view s, bool *value)
 {
+    if (s.empty()) {
+        return false;
+    }
     if (s[0] == 'F' ||s[0] == 'f' ||s[0] == 'N' || s[0] == 'n' ||s[0] == '0') {
         *value = false;
     } else if (s[0] == 'T'|| s[0] == 't' ||s[0] == 'Y' ||s[0] == 'y' ||
@@ -650,6 +654,22 @@ bool stringToBool(const string& s, bool *value)
     return true;
 }
 
+bool stringToInt(string_view s, int *value)
+{
+    const char *cp = s.data();
+    const char *end = cp + s.size();
+    while (cp < end && isspace(static_cast<unsigned char>(*cp))) {
+        cp++;
+    }
+    // from_chars() does not accept a '+' sign
+    if (cp < end && *cp == '+') {
+        if (++cp < end && *cp == '-') {
+            return false;
+        }
+    }
+    return std::from_chars(cp, end, *value).ec == std::errc();
+}
+
 bool getAdapterNames(vector<string>& names)
 {
     auto *ifs = NetIF::Interfaces::theInterfaces();
@@ -15,7 +15,11 @@ SOURCES += \
 ../libupnpp/control/avlastchg.cxx \
 ../libupnpp/control/avtransport.cxx \
 ../libupnpp/control/cdircontent.cxx \
+../libupnpp/control/cdircrawler.cxx \
+../libupnpp/control/cdircursor.cxx \
 ../libupnpp/control/cdirectory.cxx \
+../libupnpp/control/cdirfedsearch.cxx \
+../libupnpp/control/cdirsearch.cxx \
 ../libupnpp/control/conman.cxx \
 ../libupnpp/control/description.cxx \
 ../libupnpp/control/device.cxx \
@@ -32,8 +36,10 @@ SOURCES += \
 ../libupnpp/control/ohsender.cxx \
 ../libupnpp/control/ohtime.cxx \
 ../libupnpp/control/ohvolume.cxx \
+../libupnpp/control/protocolinfo.cxx \
 ../libupnpp/control/renderingcontrol.cxx \
 ../libupnpp/control/service.cxx \
+../libupnpp/control/soapclient.cxx \
 ../libupnpp/control/typedservice.cxx \
 ../libupnpp/device/device.cxx \
 ../libupnpp/device/vdir.cxx \